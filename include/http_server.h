@@ -1,6 +1,10 @@
 #pragma once
 
+#include <chrono>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <functional>
 #include <memory>
 
@@ -8,10 +12,89 @@ namespace cppwebforge {
 
 class Request;
 class Response;
+class BodyReader;
+class EventBroadcaster;
+class Next;
+class MiddlewareChain;
+
+struct CompressionOptions {
+    size_t min_size = 1024;
+    int level = 6;
+    std::vector<std::string> content_types = {
+        "text/", "application/json", "application/javascript", "application/xml", "image/svg+xml"
+    };
+    // Compressed bodies of responses carrying an ETag are kept up to this many bytes.
+    size_t variant_cache_bytes = 16 * 1024 * 1024;
+};
+
+struct CacheOptions {
+    std::chrono::milliseconds ttl{1000};
+    // Expired entries keep being served for this long while one request recomputes them.
+    std::chrono::milliseconds stale_while_revalidate{0};
+    bool include_query = true;
+    std::vector<std::string> vary_headers;
+    size_t max_bytes = 64 * 1024 * 1024;
+};
+
+struct RateLimitOptions {
+    double requests_per_second = 10.0;
+    double burst = 20.0;
+    // Clients are keyed by this request header when present, otherwise by remote address.
+    std::string key_header;
+};
+
+struct TlsOptions {
+    // PEM files; the certificate file holds the leaf followed by any intermediates.
+    std::string cert_path;
+    std::string key_path;
+    // When set, clients must present a certificate signed by one of these CAs.
+    std::string client_ca_path;
+    bool session_tickets = true;
+    size_t session_cache_size = 20 * 1024;
+    std::chrono::seconds session_timeout{300};
+    // Handshakes check the files for changes this often and pick up a rotated
+    // certificate without a restart. Zero disables the check.
+    std::chrono::seconds reload_interval{60};
+};
+
+enum class RoutePriority {
+    Critical,
+    Normal,
+    Sheddable
+};
+
+struct AdmissionOptions {
+    size_t initial_limit = 64;
+    size_t min_limit = 4;
+    size_t max_limit = 1024;
+    // Completions slower than this shrink the concurrency limit, faster ones grow it.
+    std::chrono::milliseconds latency_target{250};
+    double backoff = 0.9;
+    // Remaining time budget in milliseconds set by the caller. Requests whose
+    // budget, after their own wait in the connection queue, is no longer than
+    // the median queue wait are answered with 503 without running the handler.
+    std::string deadline_header = "X-Request-Timeout-Ms";
+};
 
 class HTTPServer {
 public:
     using Handler = std::function<void(const Request&, Response&)>;
+    // Called before the body is read; the handler pulls it through the BodyReader.
+    using StreamingHandler = std::function<void(const Request&, Response&, BodyReader&)>;
+    // Middleware runs in registration order around every route. A before hook
+    // returning false skips the rest of the chain, an around hook continues it
+    // by calling next(), and an after hook runs once the inner chain returns.
+    using BeforeMiddleware = std::function<bool(const Request&, Response&)>;
+    using AfterMiddleware = std::function<void(const Request&, Response&)>;
+    using AroundMiddleware = std::function<void(const Request&, Response&, const Next&)>;
+    // An async handler finishes by calling done() exactly once, from any thread.
+    // Request and Response stay valid until then. The worker that dispatched it
+    // is parked and a spare worker takes its place in the pool. If the request's
+    // deadline passes, or the server stops or its shutdown deadline passes,
+    // before done() is called, the client gets 503 and whatever the handler
+    // writes afterwards is discarded.
+    using Completion = std::function<void()>;
+    using AsyncHandler = std::function<void(const Request&, Response&, Completion done)>;
 
     class Builder {
     public:
@@ -20,11 +103,57 @@ public:
         
         Builder& get(const std::string& path, const Handler& handler);
         Builder& post(const std::string& path, const Handler& handler);
+        Builder& post(const std::string& path, const StreamingHandler& handler);
         Builder& put(const std::string& path, const Handler& handler);
+        Builder& put(const std::string& path, const StreamingHandler& handler);
         Builder& del(const std::string& path, const Handler& handler);
+        // Streams the broadcaster's events to every GET client as text/event-stream.
+        // Each subscriber keeps a worker for the life of the stream and may only
+        // use the spares between worker_threads and max_worker_threads, so size
+        // max_worker_threads for the expected number of listeners. Subscribers
+        // beyond that are answered with 503 and Retry-After. Only server-sent
+        // events are supported; WebSocket is out of scope.
+        Builder& events(const std::string& path, std::shared_ptr<EventBroadcaster> broadcaster);
+        Builder& get_async(const std::string& path, const AsyncHandler& handler);
+        Builder& post_async(const std::string& path, const AsyncHandler& handler);
+        Builder& put_async(const std::string& path, const AsyncHandler& handler);
+        Builder& del_async(const std::string& path, const AsyncHandler& handler);
+        // Requests whose body is larger are answered with 413, before reading when Content-Length is sent.
+        Builder& max_body_size(const std::string& path, size_t bytes);
+        
+        Builder& before(const BeforeMiddleware& middleware);
+        Builder& after(const AfterMiddleware& middleware);
+        Builder& around(const AroundMiddleware& middleware);
         
         Builder& port(int port);
         Builder& address(const std::string& addr);
+        Builder& compression(const CompressionOptions& options = CompressionOptions());
+        Builder& cache(const std::string& path, const CacheOptions& options = CacheOptions());
+        
+        Builder& keep_alive_max_count(size_t count);
+        // Idle keep-alive connections are closed once this timeout elapses.
+        Builder& keep_alive_timeout(std::chrono::seconds timeout);
+        Builder& read_timeout(std::chrono::microseconds timeout);
+        Builder& write_timeout(std::chrono::microseconds timeout);
+        Builder& payload_max_length(size_t length);
+        Builder& worker_threads(size_t count);
+        // Upper bound on workers, including spares started for parked async handlers.
+        // Defaults to four times worker_threads.
+        Builder& max_worker_threads(size_t count);
+        Builder& max_connections(size_t count);
+        // httplib does not expose accepted sockets, so this caps in-flight requests per client address.
+        Builder& max_connections_per_ip(size_t count);
+        // Lets a replacement process bind the same address and port before this one drains.
+        Builder& reuse_port(bool enabled = true);
+        // Serves per-route request counts, latency histograms and byte totals in Prometheus text format.
+        Builder& metrics(const std::string& path = "/metrics");
+        // Serves HTTPS instead of plain HTTP. Throws if the certificate or key cannot be loaded.
+        Builder& tls(const TlsOptions& options);
+        // Caps concurrent handlers with an adaptive limit and answers the excess with 503.
+        Builder& admission_control(const AdmissionOptions& options = AdmissionOptions());
+        Builder& priority(const std::string& path, RoutePriority priority);
+        // Answers clients over their token bucket with 429 and Retry-After before the handler runs.
+        Builder& rate_limit(const std::string& path, const RateLimitOptions& options = RateLimitOptions());
         
         std::unique_ptr<HTTPServer> build();
         
@@ -37,6 +166,12 @@ public:
     ~HTTPServer();
     void start();
     void stop();
+    // Stops accepting, answers remaining requests with Connection: close and waits
+    // for open connections to finish. Returns false if the deadline passed first.
+    // The server can be started again afterwards.
+    bool shutdown(std::chrono::milliseconds deadline);
+    // Re-reads the TLS certificate and key; new handshakes use them, existing sessions stay valid.
+    void reload_certificates();
     
 protected:
     class HTTPServerImpl;
@@ -47,6 +182,24 @@ private:
     friend class Builder;
     friend class Request;
     friend class Response;
+    friend class BodyReader;
+    friend class EventBroadcaster;
+};
+
+class Next {
+public:
+    void operator()() const;
+
+private:
+    Next(const MiddlewareChain& chain, size_t index, const HTTPServer::Handler& handler,
+         const Request& req, Response& res);
+
+    const MiddlewareChain& chain_;
+    size_t index_;
+    const HTTPServer::Handler& handler_;
+    const Request& req_;
+    Response& res_;
+    friend class MiddlewareChain;
 };
 
 class Request {
@@ -60,23 +213,105 @@ public:
     std::string get_header_value(const std::string& key) const;
     bool has_header(const std::string& key) const;
     
+    // Views point into the request and stay valid until the handler returns.
+    std::optional<std::string_view> header(std::string_view key) const;
+    std::optional<std::string_view> query(std::string_view key) const;
+    std::optional<std::string_view> path_param(std::string_view key) const;
+    std::optional<std::string_view> cookie(std::string_view name) const;
+    void for_each_header(const std::function<void(std::string_view, std::string_view)>& visitor) const;
+    // Set from the admission deadline header, measured from when the connection was queued.
+    std::optional<std::chrono::steady_clock::time_point> deadline() const;
+    
 private:
     class RequestImpl;
+    explicit Request(std::unique_ptr<RequestImpl> impl);
     std::unique_ptr<RequestImpl> impl_;
     friend class HTTPServer::HTTPServerImpl;
 };
 
+class BodyReader {
+public:
+    using Receiver = std::function<bool(std::string_view chunk)>;
+
+    ~BodyReader();
+
+    BodyReader(const BodyReader&) = delete;
+    BodyReader& operator=(const BodyReader&) = delete;
+
+    // Reads the body once; returns false if the receiver stops, the limit is exceeded or the client fails.
+    bool read(const Receiver& receiver);
+    size_t bytes_read() const;
+    bool limit_exceeded() const;
+
+private:
+    class ReaderImpl;
+    explicit BodyReader(std::unique_ptr<ReaderImpl> impl);
+    std::unique_ptr<ReaderImpl> impl_;
+    friend class HTTPServer::HTTPServerImpl;
+};
+
+// Fans server-sent events out to the subscribers of events() routes. Each event
+// is formatted once into a shared buffer that every connection writes from.
+class EventBroadcaster {
+public:
+    // Subscribers that fall more than backlog events behind are disconnected.
+    explicit EventBroadcaster(size_t backlog = 1024);
+    ~EventBroadcaster();
+
+    EventBroadcaster(const EventBroadcaster&) = delete;
+    EventBroadcaster& operator=(const EventBroadcaster&) = delete;
+
+    // Each line of data is sent as its own data field. event and id are single
+    // fields, so any CR or LF in them is dropped.
+    void publish(std::string_view data, std::string_view event = {}, std::string_view id = {});
+    // Ends every stream; later publishes are dropped.
+    void close();
+    size_t subscribers() const;
+
+private:
+    class BroadcasterImpl;
+    std::unique_ptr<BroadcasterImpl> impl_;
+    friend class HTTPServer::HTTPServerImpl;
+};
+
+class ResponseWriter {
+public:
+    ~ResponseWriter();
+
+    ResponseWriter(const ResponseWriter&) = delete;
+    ResponseWriter& operator=(const ResponseWriter&) = delete;
+
+    bool write(std::string_view data);
+    bool flush();
+
+private:
+    class WriterImpl;
+    explicit ResponseWriter(std::unique_ptr<WriterImpl> impl);
+    std::unique_ptr<WriterImpl> impl_;
+    friend class Response;
+};
+
 class Response {
 public:
+    // Runs after the handler returns; write() and flush() return false once the client has gone away.
+    using ChunkedContentProvider = std::function<void(ResponseWriter&)>;
+    using SharedBuffer = std::shared_ptr<const std::string>;
+
     Response();
     ~Response();
     
     void set_content(const std::string& content, const std::string& content_type);
+    void set_content(std::string&& content, const std::string& content_type);
+    void set_content(SharedBuffer content, const std::string& content_type);
+    // The caller guarantees the viewed bytes outlive the response, e.g. static or server-owned data.
+    void set_content_view(std::string_view content, const std::string& content_type);
+    void set_chunked_content(const std::string& content_type, ChunkedContentProvider provider);
     void set_header(const std::string& key, const std::string& value);
     void set_status(int status);
     
 private:
     class ResponseImpl;
+    explicit Response(std::unique_ptr<ResponseImpl> impl);
     std::unique_ptr<ResponseImpl> impl_;
     friend class HTTPServer::HTTPServerImpl;
 };
@@ -1,9 +1,16 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <chrono>
+#include <concepts>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <iosfwd>
 #include <map>
 #include <memory>
+#include <type_traits>
 #include <variant>
 #include <vector>
 #include <stdexcept>
@@ -25,6 +32,143 @@ public:
         using variant::variant;
     };
 
+    class DataDocument;
+
+    // Data converted once into the form templates are rendered from. Build one
+    // for data that is rendered repeatedly; copies share the converted data
+    // until one of them is modified.
+    class Context {
+    public:
+        Context();
+        explicit Context(const DataMap& data);
+        explicit Context(DataMap&& data);
+        explicit Context(const DataDocument& document);
+        ~Context();
+
+        Context(const Context&);
+        Context& operator=(const Context&);
+        Context(Context&&) noexcept;
+        Context& operator=(Context&&) noexcept;
+
+        void set(const std::string& key, const DataValue& value);
+        void set(const std::string& key, DataValue&& value);
+
+    private:
+        void detach();
+
+        class ContextImpl;
+        std::shared_ptr<ContextImpl> impl_;
+        friend class TemplateRenderer;
+    };
+
+    // Compact alternative to DataMap for large data sets. Values are appended
+    // in document order to a single node array, keys are interned and short
+    // strings stored inline, so building costs a few allocations in total
+    // rather than several per value. Copies share storage until written to.
+    class DataDocument {
+    public:
+        DataDocument();
+        ~DataDocument();
+
+        DataDocument(const DataDocument&);
+        DataDocument& operator=(const DataDocument&);
+        DataDocument(DataDocument&&) noexcept;
+        DataDocument& operator=(DataDocument&&) noexcept;
+
+        void reserve(size_t values, size_t textBytes);
+        size_t size() const;
+
+        // Members of the innermost open object; the root object is always open.
+        DataDocument& beginObject(std::string_view key);
+        DataDocument& beginArray(std::string_view key);
+        DataDocument& add(std::string_view key, std::string_view value);
+        DataDocument& add(std::string_view key, const char* value);
+        DataDocument& add(std::string_view key, int value);
+        DataDocument& add(std::string_view key, int64_t value);
+        DataDocument& add(std::string_view key, uint64_t value);
+        DataDocument& add(std::string_view key, double value);
+        DataDocument& add(std::string_view key, bool value);
+        // Other integer types, such as unsigned or long long, would otherwise be
+        // ambiguous between the overloads above.
+        template <std::integral T>
+            requires(!std::same_as<T, bool>)
+        DataDocument& add(std::string_view key, T value) {
+            if constexpr (std::is_signed_v<T>) {
+                return add(key, static_cast<int64_t>(value));
+            } else {
+                return add(key, static_cast<uint64_t>(value));
+            }
+        }
+
+        // Elements of the innermost open array.
+        DataDocument& beginObject();
+        DataDocument& beginArray();
+        DataDocument& add(std::string_view value);
+        DataDocument& add(const char* value);
+        DataDocument& add(int value);
+        DataDocument& add(int64_t value);
+        DataDocument& add(uint64_t value);
+        DataDocument& add(double value);
+        DataDocument& add(bool value);
+        template <std::integral T>
+            requires(!std::same_as<T, bool>)
+        DataDocument& add(T value) {
+            if constexpr (std::is_signed_v<T>) {
+                return add(static_cast<int64_t>(value));
+            } else {
+                return add(static_cast<uint64_t>(value));
+            }
+        }
+
+        // Closes the innermost open object or array.
+        DataDocument& end();
+
+    private:
+        void detach();
+
+        class DocumentImpl;
+        std::shared_ptr<DocumentImpl> impl_;
+        friend class Context;
+    };
+
+    struct RenderJob {
+        std::filesystem::path templatePath;
+        std::string outputFilename;
+        Context context;
+    };
+
+    struct RenderFailure {
+        size_t job;
+        std::string message;
+    };
+
+    // How far each output is flushed before renderers move on: not at all,
+    // the file itself, or the file and the directory entry naming it.
+    enum class SyncPolicy {
+        None,
+        File,
+        FileAndDirectory
+    };
+
+    // Outputs are always written to a temporary file and renamed into place,
+    // so readers see either the old or the new file and never a partial one.
+    // With gzip set, a compressed copy is written alongside as <name>.gz.
+    struct OutputOptions {
+        SyncPolicy sync = SyncPolicy::None;
+        bool gzip = false;
+        int gzipLevel = 6;
+    };
+
+    // Receives rendered output in order as it is produced. Returning false
+    // stops the render.
+    using OutputSink = std::function<bool(std::string_view chunk)>;
+
+    struct BatchResult {
+        size_t rendered = 0;
+        size_t skipped = 0;
+        std::vector<RenderFailure> failures;
+    };
+
     TemplateRenderer();
     ~TemplateRenderer();
     
@@ -34,10 +178,77 @@ public:
     TemplateRenderer(TemplateRenderer&&) noexcept;
     TemplateRenderer& operator=(TemplateRenderer&&) noexcept;
 
+    // Rendering does not modify the renderer, so one instance can be shared by
+    // any number of threads.
     void renderTemplate(const std::filesystem::path& templatePath,
                        const std::filesystem::path& outputDir,
                        const std::string& outputFilename,
-                       const DataMap& data);
+                       const DataMap& data) const;
+    void renderTemplate(const std::filesystem::path& templatePath,
+                       const std::filesystem::path& outputDir,
+                       const std::string& outputFilename,
+                       const Context& context) const;
+
+    std::string renderToString(const std::filesystem::path& templatePath, const DataMap& data) const;
+    std::string renderToString(const std::filesystem::path& templatePath, const Context& context) const;
+    void renderTo(const std::filesystem::path& templatePath, const DataMap& data, std::ostream& output) const;
+    void renderTo(const std::filesystem::path& templatePath, const Context& context, std::ostream& output) const;
+    // Appends to buffer, so a caller can reuse its allocation across renders.
+    void renderInto(const std::filesystem::path& templatePath, const DataMap& data, std::string& buffer) const;
+    void renderInto(const std::filesystem::path& templatePath, const Context& context, std::string& buffer) const;
+
+    // Streams output to sink in chunks of at most bufferSize bytes while the
+    // template is being rendered, so memory use does not grow with the size of
+    // the output. Returns false if the sink stopped the render early.
+    static constexpr size_t DEFAULT_STREAM_BUFFER = 64 * 1024;
+    bool renderStream(const std::filesystem::path& templatePath, const DataMap& data,
+                      const OutputSink& sink, size_t bufferSize = DEFAULT_STREAM_BUFFER) const;
+    bool renderStream(const std::filesystem::path& templatePath, const Context& context,
+                      const OutputSink& sink, size_t bufferSize = DEFAULT_STREAM_BUFFER) const;
+
+    // Renders every job into outputDir on threadCount threads, one per core when
+    // zero. Each template is compiled once for the batch, and a job that fails
+    // is reported in the result without stopping the others.
+    BatchResult renderBatch(const std::vector<RenderJob>& jobs,
+                            const std::filesystem::path& outputDir,
+                            size_t threadCount = 0) const;
+
+    // Records what every output was rendered from in the manifest at
+    // manifestPath. From then on an output whose data and template files are
+    // unchanged since its last render is skipped, and one that renders to the
+    // same bytes is left untouched on disk. Call before sharing the renderer
+    // between threads; the manifest is saved after each batch and on
+    // destruction.
+    void useManifest(const std::filesystem::path& manifestPath);
+    void saveManifest() const;
+    // Like useManifest, call before sharing the renderer between threads.
+    void setOutputOptions(const OutputOptions& options);
+
+    // Compiled templates are shared by all renderers and recompiled when the
+    // template or one of its includes changes on disk. These drop them early.
+    void reloadTemplate(const std::filesystem::path& templatePath);
+    void reloadTemplates();
+    // How long a compiled template is trusted before its files are checked
+    // again; zero, the default, checks them on every render.
+    static void setRevalidationInterval(std::chrono::milliseconds interval);
+
+    // A template registered from memory is rendered and included by name as if
+    // it were a file at that path, and is found before any file of that name;
+    // its own includes are resolved against the name's directory. Registering
+    // a name again replaces it. Sources are compiled when registered, and one
+    // that fails to compile throws TemplateError and leaves the previous
+    // source in place. registerTemplates takes a set of templates that may
+    // include each other in any order, and keeps none of them if any fails.
+    static void registerTemplate(const std::string& name, const std::string& source);
+    static void registerTemplates(const std::map<std::string, std::string>& templates);
+    static void unregisterTemplate(const std::string& name);
+    // Compiles every file under directory into the shared cache ahead of the
+    // first render and returns how many were loaded. With extensions given
+    // (".html", ".txt", ...), other files are ignored. A file that fails to
+    // compile does not stop the others: once all have been tried, one
+    // TemplateError lists every failure.
+    static size_t preloadDirectory(const std::filesystem::path& directory,
+                                   const std::vector<std::string>& extensions = {});
 
 private:
     class TemplateRendererImpl;
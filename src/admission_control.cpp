@@ -0,0 +1,74 @@
+#include "admission_control.h"
+#include <algorithm>
+
+namespace cppwebforge {
+
+namespace {
+constexpr double NORMAL_SHARE = 0.9;
+constexpr double SHEDDABLE_SHARE = 0.5;
+}
+
+ConcurrencyLimiter::ConcurrencyLimiter(const AdmissionOptions& options)
+    : options_(options),
+      limit_(static_cast<double>(std::clamp(options.initial_limit, options.min_limit, options.max_limit))) {}
+
+bool ConcurrencyLimiter::try_acquire(RoutePriority priority) {
+    size_t allowed = std::max<size_t>(1, static_cast<size_t>(limit_.load(std::memory_order_relaxed) * share(priority)));
+    size_t current = in_flight_.load(std::memory_order_relaxed);
+    do {
+        if (current >= allowed) {
+            return false;
+        }
+    } while (!in_flight_.compare_exchange_weak(current, current + 1, std::memory_order_relaxed));
+    return true;
+}
+
+void ConcurrencyLimiter::release(std::chrono::nanoseconds latency) {
+    size_t in_flight = in_flight_.fetch_sub(1, std::memory_order_relaxed);
+    double limit = limit_.load(std::memory_order_relaxed);
+
+    if (latency > options_.latency_target) {
+        int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+        int64_t last = last_decrease_.load(std::memory_order_relaxed);
+        int64_t interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(options_.latency_target).count();
+        if (now - last < interval || !last_decrease_.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+            return;
+        }
+        double lowered = std::max(static_cast<double>(options_.min_limit), limit * options_.backoff);
+        while (!limit_.compare_exchange_weak(limit, lowered, std::memory_order_relaxed)) {
+            lowered = std::max(static_cast<double>(options_.min_limit), limit * options_.backoff);
+        }
+        return;
+    }
+
+    // Only grow while the limit is the bottleneck; an idle server says nothing about capacity.
+    if (static_cast<double>(in_flight) * 2 < limit) {
+        return;
+    }
+    double raised = std::min(static_cast<double>(options_.max_limit), limit + 1.0 / limit);
+    while (!limit_.compare_exchange_weak(limit, raised, std::memory_order_relaxed)) {
+        raised = std::min(static_cast<double>(options_.max_limit), limit + 1.0 / limit);
+    }
+}
+
+size_t ConcurrencyLimiter::limit() const {
+    return static_cast<size_t>(limit_.load(std::memory_order_relaxed));
+}
+
+size_t ConcurrencyLimiter::in_flight() const {
+    return in_flight_.load(std::memory_order_relaxed);
+}
+
+double ConcurrencyLimiter::share(RoutePriority priority) {
+    switch (priority) {
+        case RoutePriority::Critical:
+            return 1.0;
+        case RoutePriority::Normal:
+            return NORMAL_SHARE;
+        case RoutePriority::Sheddable:
+            return SHEDDABLE_SHARE;
+    }
+    return NORMAL_SHARE;
+}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "http_server.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace cppwebforge {
+
+// AIMD concurrency limit. Each completed request feeds back its latency:
+// above the target the limit shrinks by options.backoff (at most once per
+// target interval), otherwise it grows by roughly one per limit's worth of
+// requests while the limit is actually being used. Lower priorities may only
+// fill part of the current limit, so they are shed first.
+class ConcurrencyLimiter {
+public:
+    explicit ConcurrencyLimiter(const AdmissionOptions& options);
+
+    bool try_acquire(RoutePriority priority);
+    void release(std::chrono::nanoseconds latency);
+
+    size_t limit() const;
+    size_t in_flight() const;
+
+private:
+    static double share(RoutePriority priority);
+
+    const AdmissionOptions options_;
+    std::atomic<double> limit_;
+    std::atomic<size_t> in_flight_{0};
+    std::atomic<int64_t> last_decrease_{0};
+};
+
+}
@@ -0,0 +1,125 @@
+#include "build_manifest.h"
+#include "template_renderer.h"
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+
+namespace cppwebforge {
+
+namespace {
+constexpr const char* MANIFEST_HEADER = "cppwebforge-manifest 1";
+
+uint64_t hashValue(uint64_t value, uint64_t seed) {
+    for (int i = 0; i < 8; ++i) {
+        seed = (seed ^ ((value >> (i * 8)) & 0xff)) * FNV_PRIME;
+    }
+    return seed;
+}
+}
+
+BuildManifest::BuildManifest(std::filesystem::path path) : path_(std::move(path)) {
+    std::ifstream input(path_);
+    std::string line;
+    if (!std::getline(input, line) || line != MANIFEST_HEADER) {
+        return;
+    }
+
+    while (std::getline(input, line)) {
+        std::istringstream fields(line);
+        OutputRecord entry;
+        std::string output;
+        fields >> std::hex >> entry.dataHash >> entry.dependencyHash >> entry.contentHash;
+        if (fields.get() == ' ' && std::getline(fields, output) && !output.empty()) {
+            outputs_[output] = entry;
+        }
+    }
+}
+
+std::optional<OutputRecord> BuildManifest::find(const std::string& output) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = outputs_.find(output);
+    if (found == outputs_.end()) {
+        return std::nullopt;
+    }
+    return found->second;
+}
+
+void BuildManifest::record(const std::string& output, const OutputRecord& entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    outputs_[output] = entry;
+    dirty_ = true;
+}
+
+void BuildManifest::save() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!dirty_) {
+        return;
+    }
+
+    std::ostringstream content;
+    content << MANIFEST_HEADER << '\n' << std::hex;
+    for (const auto& [output, entry] : outputs_) {
+        content << entry.dataHash << ' ' << entry.dependencyHash << ' ' << entry.contentHash << ' ' << output << '\n';
+    }
+
+    auto temporary = path_;
+    temporary += ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.is_open() || !(file << content.str()) || !file.flush()) {
+            throw TemplateError("Failed to write build manifest: " + temporary.string());
+        }
+    }
+    std::error_code errorCode;
+    std::filesystem::rename(temporary, path_, errorCode);
+    if (errorCode) {
+        throw TemplateError("Failed to write build manifest: " + errorCode.message());
+    }
+    dirty_ = false;
+}
+
+uint64_t BuildManifest::hashBytes(std::string_view bytes, uint64_t seed) {
+    return fnv1a(bytes, seed);
+}
+
+// Every value is prefixed with its type, and strings and containers with their
+// size, so that different documents cannot produce the same byte sequence.
+uint64_t BuildManifest::hashData(const nlohmann::json& data, uint64_t seed) {
+    seed = hashValue(static_cast<uint64_t>(data.type()), seed);
+    switch (data.type()) {
+        case nlohmann::json::value_t::object:
+            seed = hashValue(data.size(), seed);
+            for (const auto& [key, value] : data.get_ref<const nlohmann::json::object_t&>()) {
+                seed = hashBytes(key, hashValue(key.size(), seed));
+                seed = hashData(value, seed);
+            }
+            return seed;
+        case nlohmann::json::value_t::array:
+            seed = hashValue(data.size(), seed);
+            for (const auto& value : data) {
+                seed = hashData(value, seed);
+            }
+            return seed;
+        case nlohmann::json::value_t::string: {
+            const auto& text = data.get_ref<const nlohmann::json::string_t&>();
+            return hashBytes(text, hashValue(text.size(), seed));
+        }
+        case nlohmann::json::value_t::boolean:
+            return hashValue(data.get<bool>() ? 1 : 0, seed);
+        case nlohmann::json::value_t::number_integer:
+            return hashValue(static_cast<uint64_t>(data.get<int64_t>()), seed);
+        case nlohmann::json::value_t::number_unsigned:
+            return hashValue(data.get<uint64_t>(), seed);
+        case nlohmann::json::value_t::number_float: {
+            double number = data.get<double>();
+            uint64_t bits;
+            std::memcpy(&bits, &number, sizeof(bits));
+            return hashValue(bits, seed);
+        }
+        default:
+            return seed;
+    }
+}
+
+} // namespace cppwebforge
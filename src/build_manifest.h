@@ -0,0 +1,46 @@
+#pragma once
+
+#include "string_util.h"
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <nlohmann/json.hpp>
+
+namespace cppwebforge {
+
+// What an output file was last rendered from: the data, the template files
+// and the bytes produced.
+struct OutputRecord {
+    uint64_t dataHash = 0;
+    uint64_t dependencyHash = 0;
+    uint64_t contentHash = 0;
+};
+
+// Persistent record of rendered outputs, kept as a text file with one line
+// per output. The file is only a cache: lines that cannot be read are ignored
+// and the outputs they describe are rendered again.
+class BuildManifest {
+public:
+    static constexpr uint64_t HASH_SEED = FNV_OFFSET_BASIS;
+
+    explicit BuildManifest(std::filesystem::path path);
+
+    std::optional<OutputRecord> find(const std::string& output) const;
+    void record(const std::string& output, const OutputRecord& entry);
+    void save();
+
+    static uint64_t hashBytes(std::string_view bytes, uint64_t seed = HASH_SEED);
+    static uint64_t hashData(const nlohmann::json& data, uint64_t seed = HASH_SEED);
+
+private:
+    const std::filesystem::path path_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, OutputRecord> outputs_;
+    bool dirty_ = false;
+};
+
+} // namespace cppwebforge
@@ -0,0 +1,286 @@
+#include "compression.h"
+#include "string_util.h"
+#include <zlib.h>
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#ifdef CPPWEBFORGE_BROTLI_SUPPORT
+#include <brotli/encode.h>
+#endif
+
+namespace cppwebforge {
+
+namespace {
+constexpr int GZIP_WINDOW_BITS = 15 + 16;
+constexpr int DEFLATE_WINDOW_BITS = 15;
+constexpr int DEFLATE_MEMORY_LEVEL = 8;
+#ifdef CPPWEBFORGE_BROTLI_SUPPORT
+constexpr int BROTLI_MAX_LEVEL = 11;
+#endif
+
+std::string_view trim(std::string_view value) {
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+        value.remove_prefix(1);
+    }
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+        value.remove_suffix(1);
+    }
+    return value;
+}
+
+
+double parse_quality(std::string_view params) {
+    while (!params.empty()) {
+        size_t end = params.find(';');
+        std::string_view param = trim(params.substr(0, end));
+        if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+            double quality = 0.0;
+            auto [ptr, ec] = std::from_chars(param.data() + 2, param.data() + param.size(), quality);
+            return ec == std::errc() ? quality : 0.0;
+        }
+        if (end == std::string_view::npos) {
+            break;
+        }
+        params.remove_prefix(end + 1);
+    }
+    return 1.0;
+}
+
+class DeflateContext {
+public:
+    explicit DeflateContext(int window_bits) : window_bits_(window_bits) {}
+
+    ~DeflateContext() {
+        if (ready_) {
+            deflateEnd(&stream_);
+        }
+    }
+
+    DeflateContext(const DeflateContext&) = delete;
+    DeflateContext& operator=(const DeflateContext&) = delete;
+
+    z_stream* acquire(int level) {
+        if (!ready_) {
+            if (deflateInit2(&stream_, level, Z_DEFLATED, window_bits_, DEFLATE_MEMORY_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+                return nullptr;
+            }
+            ready_ = true;
+            level_ = level;
+            return &stream_;
+        }
+
+        deflateReset(&stream_);
+        if (level != level_ && deflateParams(&stream_, level, Z_DEFAULT_STRATEGY) == Z_OK) {
+            level_ = level;
+        }
+        return &stream_;
+    }
+
+private:
+    z_stream stream_{};
+    int window_bits_;
+    int level_ = Z_DEFAULT_COMPRESSION;
+    bool ready_ = false;
+};
+
+bool deflate_body(DeflateContext& context, std::string_view input, int level, std::string& output) {
+    if (input.size() > UINT_MAX) {
+        return false;
+    }
+
+    z_stream* stream = context.acquire(level);
+    if (stream == nullptr) {
+        return false;
+    }
+
+    output.resize(deflateBound(stream, static_cast<uLong>(input.size())));
+    stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    stream->avail_in = static_cast<uInt>(input.size());
+    stream->next_out = reinterpret_cast<Bytef*>(output.data());
+    stream->avail_out = static_cast<uInt>(output.size());
+
+    if (deflate(stream, Z_FINISH) != Z_STREAM_END) {
+        output.clear();
+        return false;
+    }
+
+    output.resize(stream->total_out);
+    return true;
+}
+
+#ifdef CPPWEBFORGE_BROTLI_SUPPORT
+bool brotli_body(std::string_view input, int level, std::string& output) {
+    size_t encoded_size = BrotliEncoderMaxCompressedSize(input.size());
+    if (encoded_size == 0) {
+        return false;
+    }
+
+    output.resize(encoded_size);
+    int quality = std::min(std::max(level, 0), BROTLI_MAX_LEVEL);
+    if (BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, input.size(),
+                              reinterpret_cast<const uint8_t*>(input.data()), &encoded_size,
+                              reinterpret_cast<uint8_t*>(output.data())) == BROTLI_FALSE) {
+        output.clear();
+        return false;
+    }
+
+    output.resize(encoded_size);
+    return true;
+}
+#endif
+}
+
+NegotiatedEncoding negotiate_encoding(std::string_view accept_encoding) {
+    constexpr ContentEncoding CODINGS[] = {
+        ContentEncoding::Deflate,
+        ContentEncoding::Gzip,
+#ifdef CPPWEBFORGE_BROTLI_SUPPORT
+        ContentEncoding::Brotli,
+#endif
+    };
+    // Indexed by ContentEncoding; unset entries were not listed by name.
+    std::optional<double> listed[4];
+    std::optional<double> wildcard;
+
+    while (!accept_encoding.empty()) {
+        size_t end = accept_encoding.find(',');
+        std::string_view entry = accept_encoding.substr(0, end);
+        size_t params_start = entry.find(';');
+        std::string_view token = trim(entry.substr(0, params_start));
+        double quality = params_start == std::string_view::npos ? 1.0 : parse_quality(entry.substr(params_start + 1));
+
+        if (token == "*") {
+            wildcard = quality;
+        } else if (iequals(token, "identity")) {
+            listed[static_cast<size_t>(ContentEncoding::Identity)] = quality;
+        } else if (iequals(token, "gzip") || iequals(token, "x-gzip")) {
+            listed[static_cast<size_t>(ContentEncoding::Gzip)] = quality;
+        } else if (iequals(token, "deflate")) {
+            listed[static_cast<size_t>(ContentEncoding::Deflate)] = quality;
+        } else if (iequals(token, "br")) {
+            listed[static_cast<size_t>(ContentEncoding::Brotli)] = quality;
+        }
+
+        if (end == std::string_view::npos) {
+            break;
+        }
+        accept_encoding.remove_prefix(end + 1);
+    }
+
+    NegotiatedEncoding result;
+    double best_quality = 0.0;
+    for (ContentEncoding candidate : CODINGS) {
+        double quality = listed[static_cast<size_t>(candidate)].value_or(wildcard.value_or(0.0));
+        // Ties go to the stronger encoding, which is the later entry.
+        if (quality > 0.0 && quality >= best_quality) {
+            result.encoding = candidate;
+            best_quality = quality;
+        }
+    }
+
+    double identity_quality = listed[static_cast<size_t>(ContentEncoding::Identity)].value_or(wildcard.value_or(1.0));
+    result.identity_acceptable = identity_quality > 0.0;
+    if (identity_quality > best_quality) {
+        result.encoding = ContentEncoding::Identity;
+    }
+    return result;
+}
+
+const char* encoding_token(ContentEncoding encoding) {
+    switch (encoding) {
+        case ContentEncoding::Gzip:
+            return "gzip";
+        case ContentEncoding::Deflate:
+            return "deflate";
+        case ContentEncoding::Brotli:
+            return "br";
+        case ContentEncoding::Identity:
+            break;
+    }
+    return "identity";
+}
+
+bool compress_body(ContentEncoding encoding, std::string_view input, int level, std::string& output) {
+    thread_local DeflateContext gzip_context(GZIP_WINDOW_BITS);
+    thread_local DeflateContext deflate_context(DEFLATE_WINDOW_BITS);
+
+    switch (encoding) {
+        case ContentEncoding::Gzip:
+            return deflate_body(gzip_context, input, level, output);
+        case ContentEncoding::Deflate:
+            return deflate_body(deflate_context, input, level, output);
+        case ContentEncoding::Brotli:
+#ifdef CPPWEBFORGE_BROTLI_SUPPORT
+            return brotli_body(input, level, output);
+#else
+            return false;
+#endif
+        case ContentEncoding::Identity:
+            break;
+    }
+    return false;
+}
+
+class CompressedVariantCache::CacheImpl {
+public:
+    explicit CacheImpl(size_t max_bytes) : max_bytes_(max_bytes), bytes_(0) {}
+
+    std::shared_ptr<const std::string> find(const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto entry = index_.find(key);
+        if (entry == index_.end()) {
+            return nullptr;
+        }
+        entries_.splice(entries_.begin(), entries_, entry->second);
+        return entry->second->second;
+    }
+
+    void insert(const std::string& key, std::shared_ptr<const std::string> body) {
+        size_t size = key.size() + body->size();
+        if (size > max_bytes_) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (index_.count(key) != 0) {
+            return;
+        }
+
+        while (bytes_ + size > max_bytes_ && !entries_.empty()) {
+            auto& oldest = entries_.back();
+            bytes_ -= oldest.first.size() + oldest.second->size();
+            index_.erase(oldest.first);
+            entries_.pop_back();
+        }
+
+        entries_.emplace_front(key, std::move(body));
+        index_.emplace(key, entries_.begin());
+        bytes_ += size;
+    }
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<const std::string>>;
+
+    std::mutex mutex_;
+    std::list<Entry> entries_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    const size_t max_bytes_;
+    size_t bytes_;
+};
+
+CompressedVariantCache::CompressedVariantCache(size_t max_bytes) : impl_(std::make_unique<CacheImpl>(max_bytes)) {}
+CompressedVariantCache::~CompressedVariantCache() = default;
+
+std::shared_ptr<const std::string> CompressedVariantCache::find(const std::string& key) {
+    return impl_->find(key);
+}
+
+void CompressedVariantCache::insert(const std::string& key, std::shared_ptr<const std::string> body) {
+    impl_->insert(key, std::move(body));
+}
+
+} // namespace cppwebforge
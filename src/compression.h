@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <memory>
+
+namespace cppwebforge {
+
+enum class ContentEncoding {
+    Identity,
+    Deflate,
+    Gzip,
+    Brotli
+};
+
+struct NegotiatedEncoding {
+    ContentEncoding encoding = ContentEncoding::Identity;
+    // False when the client excluded identity with "identity;q=0" or "*;q=0".
+    bool identity_acceptable = true;
+};
+
+// Follows RFC 9110 section 12.5.3: "*" covers codings not listed by name, and
+// identity is acceptable unless excluded explicitly.
+NegotiatedEncoding negotiate_encoding(std::string_view accept_encoding);
+const char* encoding_token(ContentEncoding encoding);
+bool compress_body(ContentEncoding encoding, std::string_view input, int level, std::string& output);
+
+class CompressedVariantCache {
+public:
+    explicit CompressedVariantCache(size_t max_bytes);
+    ~CompressedVariantCache();
+
+    CompressedVariantCache(const CompressedVariantCache&) = delete;
+    CompressedVariantCache& operator=(const CompressedVariantCache&) = delete;
+
+    std::shared_ptr<const std::string> find(const std::string& key);
+    void insert(const std::string& key, std::shared_ptr<const std::string> body);
+
+private:
+    class CacheImpl;
+    std::unique_ptr<CacheImpl> impl_;
+};
+
+} // namespace cppwebforge
@@ -0,0 +1,268 @@
+#include "data_document.h"
+#include <cstring>
+#include <limits>
+
+namespace cppwebforge {
+
+TemplateRenderer::DataDocument::DocumentImpl::DocumentImpl() {
+    Node& root = nodes.emplace_back();
+    root.type = NodeType::Object;
+    root.key = NO_KEY;
+    root.children = {0, 0};
+    openContainers.push_back(0);
+}
+
+// The key index points into the key strings, so a copy has to rebuild it
+// against its own.
+TemplateRenderer::DataDocument::DocumentImpl::DocumentImpl(const DocumentImpl& other)
+    : nodes(other.nodes), text(other.text), keys(other.keys), openContainers(other.openContainers) {
+    keyIds.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        keyIds.emplace(keys[i], static_cast<uint32_t>(i));
+    }
+}
+
+uint32_t TemplateRenderer::DataDocument::DocumentImpl::intern(std::string_view key) {
+    auto found = keyIds.find(key);
+    if (found != keyIds.end()) {
+        return found->second;
+    }
+    auto id = static_cast<uint32_t>(keys.size());
+    keyIds.emplace(keys.emplace_back(key), id);
+    return id;
+}
+
+TemplateRenderer::DataDocument::DocumentImpl::Node&
+TemplateRenderer::DataDocument::DocumentImpl::append(NodeType type, std::string_view key, bool keyed) {
+    Node& parent = nodes[openContainers.back()];
+    if (keyed != (parent.type == NodeType::Object)) {
+        throw TemplateError(keyed ? "Data document value with a key added to an array"
+                                  : "Data document value without a key added to an object");
+    }
+    if (nodes.size() >= NO_KEY) {
+        throw TemplateError("Data document is too large");
+    }
+    ++parent.children.count;
+
+    uint32_t keyId = keyed ? intern(key) : NO_KEY;
+    Node& node = nodes.emplace_back();
+    node.type = type;
+    node.key = keyId;
+    return node;
+}
+
+void TemplateRenderer::DataDocument::DocumentImpl::appendString(std::string_view value, std::string_view key, bool keyed) {
+    if (value.size() <= SHORT_STRING_LENGTH) {
+        Node& node = append(NodeType::ShortString, key, keyed);
+        node.shortLength = static_cast<uint8_t>(value.size());
+        std::memcpy(node.shortText, value.data(), value.size());
+        return;
+    }
+    if (text.size() + value.size() > std::numeric_limits<uint32_t>::max()) {
+        throw TemplateError("Data document is too large");
+    }
+    Node& node = append(NodeType::String, key, keyed);
+    node.text = {static_cast<uint32_t>(text.size()), static_cast<uint32_t>(value.size())};
+    text.append(value);
+}
+
+void TemplateRenderer::DataDocument::DocumentImpl::open(NodeType type, std::string_view key, bool keyed) {
+    append(type, key, keyed).children = {0, 0};
+    openContainers.push_back(static_cast<uint32_t>(nodes.size() - 1));
+}
+
+void TemplateRenderer::DataDocument::DocumentImpl::close() {
+    if (openContainers.size() == 1) {
+        throw TemplateError("Data document has no open object or array to end");
+    }
+    nodes[openContainers.back()].children.end = static_cast<uint32_t>(nodes.size());
+    openContainers.pop_back();
+}
+
+uint32_t TemplateRenderer::DataDocument::DocumentImpl::subtreeEnd(uint32_t index) const {
+    if (index == 0) {
+        return static_cast<uint32_t>(nodes.size());
+    }
+    const Node& node = nodes[index];
+    if (node.type == NodeType::Object || node.type == NodeType::Array) {
+        return node.children.end;
+    }
+    return index + 1;
+}
+
+nlohmann::json TemplateRenderer::DataDocument::DocumentImpl::convert(uint32_t index) const {
+    const Node& node = nodes[index];
+    switch (node.type) {
+        case NodeType::String:
+            return std::string(text, node.text.offset, node.text.length);
+        case NodeType::ShortString:
+            return std::string(node.shortText, node.shortLength);
+        case NodeType::Int:
+            return node.integer;
+        case NodeType::UInt:
+            return node.unsignedInteger;
+        case NodeType::Double:
+            return node.number;
+        case NodeType::Bool:
+            return node.boolean;
+        case NodeType::Object: {
+            nlohmann::json object(nlohmann::json::value_t::object);
+            auto& entries = object.get_ref<nlohmann::json::object_t&>();
+            uint32_t end = subtreeEnd(index);
+            for (uint32_t child = index + 1; child < end; child = subtreeEnd(child)) {
+                entries.insert_or_assign(keys[nodes[child].key], convert(child));
+            }
+            return object;
+        }
+        case NodeType::Array: {
+            nlohmann::json array(nlohmann::json::value_t::array);
+            auto& elements = array.get_ref<nlohmann::json::array_t&>();
+            elements.reserve(node.children.count);
+            uint32_t end = subtreeEnd(index);
+            for (uint32_t child = index + 1; child < end; child = subtreeEnd(child)) {
+                elements.push_back(convert(child));
+            }
+            return array;
+        }
+    }
+    throw TemplateError("Invalid data document node");
+}
+
+nlohmann::json TemplateRenderer::DataDocument::DocumentImpl::toJson() const {
+    if (openContainers.size() > 1) {
+        throw TemplateError("Data document has an object or array that was not ended");
+    }
+    return convert(0);
+}
+
+TemplateRenderer::DataDocument::DataDocument() : impl_(std::make_shared<DocumentImpl>()) {}
+TemplateRenderer::DataDocument::~DataDocument() = default;
+
+TemplateRenderer::DataDocument::DataDocument(const DataDocument&) = default;
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::operator=(const DataDocument&) = default;
+TemplateRenderer::DataDocument::DataDocument(DataDocument&&) noexcept = default;
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::operator=(DataDocument&&) noexcept = default;
+
+void TemplateRenderer::DataDocument::detach() {
+    if (impl_.use_count() > 1) {
+        impl_ = std::make_shared<DocumentImpl>(*impl_);
+    }
+}
+
+void TemplateRenderer::DataDocument::reserve(size_t values, size_t textBytes) {
+    detach();
+    impl_->nodes.reserve(values + 1);
+    impl_->text.reserve(textBytes);
+}
+
+size_t TemplateRenderer::DataDocument::size() const {
+    return impl_->nodes.size() - 1;
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::beginObject(std::string_view key) {
+    detach();
+    impl_->open(DocumentImpl::NodeType::Object, key, true);
+    return *this;
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::beginArray(std::string_view key) {
+    detach();
+    impl_->open(DocumentImpl::NodeType::Array, key, true);
+    return *this;
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::add(std::string_view key, std::string_view value) {
+    detach();
+    impl_->appendString(value, key, true);
+    return *this;
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::add(std::string_view key, const char* value) {
+    return add(key, std::string_view(value));
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::add(std::string_view key, int value) {
+    return add(key, static_cast<int64_t>(value));
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::add(std::string_view key, int64_t value) {
+    detach();
+    impl_->append(DocumentImpl::NodeType::Int, key, true).integer = value;
+    return *this;
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::add(std::string_view key, uint64_t value) {
+    detach();
+    impl_->append(DocumentImpl::NodeType::UInt, key, true).unsignedInteger = value;
+    return *this;
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::add(std::string_view key, double value) {
+    detach();
+    impl_->append(DocumentImpl::NodeType::Double, key, true).number = value;
+    return *this;
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::add(std::string_view key, bool value) {
+    detach();
+    impl_->append(DocumentImpl::NodeType::Bool, key, true).boolean = value;
+    return *this;
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::beginObject() {
+    detach();
+    impl_->open(DocumentImpl::NodeType::Object, {}, false);
+    return *this;
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::beginArray() {
+    detach();
+    impl_->open(DocumentImpl::NodeType::Array, {}, false);
+    return *this;
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::add(std::string_view value) {
+    detach();
+    impl_->appendString(value, {}, false);
+    return *this;
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::add(const char* value) {
+    return add(std::string_view(value));
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::add(int value) {
+    return add(static_cast<int64_t>(value));
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::add(int64_t value) {
+    detach();
+    impl_->append(DocumentImpl::NodeType::Int, {}, false).integer = value;
+    return *this;
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::add(uint64_t value) {
+    detach();
+    impl_->append(DocumentImpl::NodeType::UInt, {}, false).unsignedInteger = value;
+    return *this;
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::add(double value) {
+    detach();
+    impl_->append(DocumentImpl::NodeType::Double, {}, false).number = value;
+    return *this;
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::add(bool value) {
+    detach();
+    impl_->append(DocumentImpl::NodeType::Bool, {}, false).boolean = value;
+    return *this;
+}
+
+TemplateRenderer::DataDocument& TemplateRenderer::DataDocument::end() {
+    detach();
+    impl_->close();
+    return *this;
+}
+
+} // namespace cppwebforge
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "template_renderer.h"
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+namespace cppwebforge {
+
+// Nodes are stored in document order: an object or array is followed directly
+// by its children, and records where its subtree ends so siblings can be
+// reached without following pointers.
+class TemplateRenderer::DataDocument::DocumentImpl {
+public:
+    enum class NodeType : uint8_t { String, ShortString, Int, UInt, Double, Bool, Object, Array };
+
+    static constexpr uint32_t NO_KEY = UINT32_MAX;
+    static constexpr size_t SHORT_STRING_LENGTH = 8;
+
+    struct Span {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Children {
+        uint32_t count;
+        uint32_t end;
+    };
+
+    struct Node {
+        NodeType type;
+        uint8_t shortLength;
+        uint32_t key;
+        union {
+            int64_t integer;
+            uint64_t unsignedInteger;
+            double number;
+            bool boolean;
+            char shortText[SHORT_STRING_LENGTH];
+            Span text;
+            Children children;
+        };
+    };
+
+    DocumentImpl();
+    DocumentImpl(const DocumentImpl& other);
+    DocumentImpl& operator=(const DocumentImpl&) = delete;
+
+    Node& append(NodeType type, std::string_view key, bool keyed);
+    void appendString(std::string_view value, std::string_view key, bool keyed);
+    void open(NodeType type, std::string_view key, bool keyed);
+    void close();
+
+    nlohmann::json toJson() const;
+
+    std::vector<Node> nodes;
+    std::string text;
+    std::deque<std::string> keys;
+    std::unordered_map<std::string_view, uint32_t> keyIds;
+    std::vector<uint32_t> openContainers;
+
+private:
+    uint32_t intern(std::string_view key);
+    uint32_t subtreeEnd(uint32_t index) const;
+    nlohmann::json convert(uint32_t index) const;
+};
+
+} // namespace cppwebforge
@@ -0,0 +1,120 @@
+#include "event_broadcaster.h"
+#include <algorithm>
+#include <mutex>
+
+namespace cppwebforge {
+
+namespace {
+// A line break ends a field in the event stream, so one inside a single-line
+// field is dropped rather than allowed to start a field of its own.
+void append_field(std::string& formatted, std::string_view name, std::string_view value) {
+    formatted.append(name).append(": ");
+    for (char character : value) {
+        if (character != '\r' && character != '\n') {
+            formatted.push_back(character);
+        }
+    }
+    formatted.push_back('\n');
+}
+}
+
+EventBroadcaster::BroadcasterImpl::BroadcasterImpl(size_t backlog) : ring_(std::max<size_t>(backlog, 1)) {}
+
+void EventBroadcaster::BroadcasterImpl::publish(Event event) {
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        if (closed_) {
+            return;
+        }
+        ring_[next_ % ring_.size()] = std::move(event);
+        ++next_;
+    }
+    published_.notify_all();
+}
+
+void EventBroadcaster::BroadcasterImpl::close() {
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        closed_ = true;
+    }
+    published_.notify_all();
+}
+
+void EventBroadcaster::BroadcasterImpl::wake() {
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+    }
+    published_.notify_all();
+}
+
+uint64_t EventBroadcaster::BroadcasterImpl::subscribe() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    ++subscribers_;
+    return next_;
+}
+
+void EventBroadcaster::BroadcasterImpl::unsubscribe() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    --subscribers_;
+}
+
+bool EventBroadcaster::BroadcasterImpl::wait(uint64_t& cursor, std::vector<Event>& batch,
+                                             std::chrono::milliseconds timeout, const std::atomic<bool>& stopped) {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    published_.wait_for(lock, timeout, [this, cursor, &stopped] { return closed_ || stopped || next_ > cursor; });
+    if (closed_ || stopped || next_ - cursor > ring_.size()) {
+        return false;
+    }
+    for (; cursor < next_; ++cursor) {
+        batch.push_back(ring_[cursor % ring_.size()]);
+    }
+    return true;
+}
+
+size_t EventBroadcaster::BroadcasterImpl::subscribers() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return subscribers_;
+}
+
+std::string EventBroadcaster::BroadcasterImpl::format(std::string_view data, std::string_view event,
+                                                      std::string_view id) {
+    std::string formatted;
+    formatted.reserve(data.size() + event.size() + id.size() + 32);
+    if (!id.empty()) {
+        append_field(formatted, "id", id);
+    }
+    if (!event.empty()) {
+        append_field(formatted, "event", event);
+    }
+    // CR, LF and CRLF all end a line, so data is split at each of them.
+    for (;;) {
+        size_t end = data.find_first_of("\r\n");
+        formatted.append("data: ").append(data.substr(0, end)).append("\n");
+        if (end == std::string_view::npos) {
+            break;
+        }
+        data.remove_prefix(end + (data.substr(end, 2) == "\r\n" ? 2 : 1));
+    }
+    formatted.append("\n");
+    return formatted;
+}
+
+EventBroadcaster::EventBroadcaster(size_t backlog) : impl_(std::make_unique<BroadcasterImpl>(backlog)) {}
+
+EventBroadcaster::~EventBroadcaster() {
+    impl_->close();
+}
+
+void EventBroadcaster::publish(std::string_view data, std::string_view event, std::string_view id) {
+    impl_->publish(std::make_shared<const std::string>(BroadcasterImpl::format(data, event, id)));
+}
+
+void EventBroadcaster::close() {
+    impl_->close();
+}
+
+size_t EventBroadcaster::subscribers() const {
+    return impl_->subscribers();
+}
+
+} // namespace cppwebforge
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "http_server.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cppwebforge {
+
+// Ring of formatted events addressed by sequence number. Publishing stores one
+// shared buffer and wakes every subscriber; each subscriber copies out only the
+// pointers past its own cursor, under a shared lock.
+class EventBroadcaster::BroadcasterImpl {
+public:
+    using Event = std::shared_ptr<const std::string>;
+
+    explicit BroadcasterImpl(size_t backlog);
+
+    void publish(Event event);
+    void close();
+    // Wakes every waiting subscriber so that it can notice its server stopping.
+    void wake();
+
+    uint64_t subscribe();
+    void unsubscribe();
+    // Appends the events after cursor to batch, waiting up to timeout for one to arrive.
+    // Returns false once the broadcaster is closed, stopped is set or the subscriber fell out of the backlog.
+    bool wait(uint64_t& cursor, std::vector<Event>& batch, std::chrono::milliseconds timeout,
+              const std::atomic<bool>& stopped);
+    size_t subscribers() const;
+
+    static std::string format(std::string_view data, std::string_view event, std::string_view id);
+
+private:
+    mutable std::shared_mutex mutex_;
+    std::condition_variable_any published_;
+    std::vector<Event> ring_;
+    uint64_t next_ = 0;
+    bool closed_ = false;
+    size_t subscribers_ = 0;
+};
+
+} // namespace cppwebforge
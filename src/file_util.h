@@ -0,0 +1,16 @@
+#pragma once
+
+#include <filesystem>
+#include <system_error>
+
+namespace cppwebforge {
+
+// Last write time of path, or file_time_type::min() if it cannot be read, so
+// a file that disappears compares as changed.
+inline std::filesystem::file_time_type modified_time(const std::filesystem::path& path) {
+    std::error_code error;
+    auto time = std::filesystem::last_write_time(path, error);
+    return error ? std::filesystem::file_time_type::min() : time;
+}
+
+} // namespace cppwebforge
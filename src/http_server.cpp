@@ -1,46 +1,395 @@
 #include "http_server.h"
+#include "admission_control.h"
+#include "rate_limiter.h"
+#include "tls_context.h"
+#include "compression.h"
+#include "event_broadcaster.h"
+#include "response_cache.h"
+#include "server_metrics.h"
+#include "string_util.h"
 #include "httplib.h"
+#include <charconv>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <sys/socket.h>
+#include <string_view>
+#include <variant>
+#include <vector>
 
 namespace cppwebforge {
 
 namespace {
 constexpr int DEFAULT_PORT = 8080;
 constexpr const char* DEFAULT_ADDRESS = "0.0.0.0";
+constexpr size_t STREAM_BUFFER_SIZE = 16 * 1024;
+
+constexpr int HTTP_OK = 200;
+constexpr int HTTP_BAD_REQUEST = 400;
+constexpr int HTTP_PAYLOAD_TOO_LARGE = 413;
+constexpr int HTTP_TOO_MANY_REQUESTS = 429;
+constexpr int HTTP_SERVICE_UNAVAILABLE = 503;
+constexpr unsigned MIN_WORKER_THREADS = 8;
+constexpr size_t ASYNC_WORKER_FACTOR = 4;
+constexpr int HTTP_SERVICE_UNAVAILABLE_RETRY_SECONDS = 1;
+constexpr auto DRAIN_POLL_INTERVAL = std::chrono::milliseconds(5);
+constexpr size_t MAX_DISCARDED_BODY = 64 * 1024;
+constexpr auto EVENT_HEARTBEAT_INTERVAL = std::chrono::seconds(15);
+constexpr auto SPARE_WORKER_IDLE_TIMEOUT = std::chrono::seconds(10);
+
+void erase_header(httplib::Response& res, const std::string& key) {
+    auto range = res.headers.equal_range(key);
+    res.headers.erase(range.first, range.second);
+}
+
+// Adds field to the response's Vary header, keeping whatever the handler
+// already listed there instead of sending a second Vary header.
+void add_vary(httplib::Response& res, std::string_view field) {
+    auto vary = res.headers.find("Vary");
+    if (vary == res.headers.end()) {
+        res.set_header("Vary", std::string(field));
+        return;
+    }
+    std::string_view listed = vary->second;
+    while (!listed.empty()) {
+        size_t end = listed.find(',');
+        std::string_view token = listed.substr(0, end);
+        while (!token.empty() && (token.front() == ' ' || token.front() == '\t')) {
+            token.remove_prefix(1);
+        }
+        while (!token.empty() && (token.back() == ' ' || token.back() == '\t')) {
+            token.remove_suffix(1);
+        }
+        if (token == "*" || iequals(token, field)) {
+            return;
+        }
+        listed = end == std::string_view::npos ? std::string_view() : listed.substr(end + 1);
+    }
+    vary->second = vary->second.empty() ? std::string(field) : vary->second + ", " + std::string(field);
+}
+
+std::optional<size_t> declared_length(const httplib::Request& req) {
+    if (!req.has_header("Content-Length")) {
+        return std::nullopt;
+    }
+    std::string value = req.get_header_value("Content-Length");
+    size_t length = 0;
+    auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), length);
+    if (ec != std::errc()) {
+        return std::nullopt;
+    }
+    return length;
+}
+
+void reject_request(httplib::Response& res, int status, const char* message) {
+    res.status = status;
+    res.set_content(message, "text/plain");
+    erase_header(res, "Connection");
+    res.set_header("Connection", "close");
+}
+
+std::string weak_etag(std::string_view body) {
+    uint64_t hash = fnv1a(body);
+
+    char etag[24];
+    std::snprintf(etag, sizeof(etag), "W/\"%016llx\"", static_cast<unsigned long long>(hash));
+    return etag;
+}
 }
 
 class Request::RequestImpl {
 public:
-    RequestImpl(const httplib::Request& req) : req_(req) {}
+    RequestImpl(const httplib::Request& req) : req_(req), body_(req.body) {}
+    RequestImpl(const httplib::Request& req, const std::string& body) : req_(req), body_(body) {}
     const httplib::Request& req_;
+    const std::string& body_;
+    std::optional<std::chrono::steady_clock::time_point> deadline_;
 };
 
 Request::Request() : impl_(std::make_unique<RequestImpl>(httplib::Request())) {}
 Request::~Request() = default;
 
-const std::string& Request::body() const { return impl_->req_.body; }
+const std::string& Request::body() const { return impl_->body_; }
 const std::string& Request::path() const { return impl_->req_.path; }
 const std::string& Request::method() const { return impl_->req_.method; }
 std::string Request::get_header_value(const std::string& key) const { return impl_->req_.get_header_value(key); }
 bool Request::has_header(const std::string& key) const { return impl_->req_.has_header(key); }
 
+Request::Request(std::unique_ptr<RequestImpl> impl) : impl_(std::move(impl)) {}
+
+std::optional<std::string_view> Request::header(std::string_view key) const {
+    for (const auto& [name, value] : impl_->req_.headers) {
+        if (iequals(name, key)) {
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<std::string_view> Request::query(std::string_view key) const {
+    for (const auto& [name, value] : impl_->req_.params) {
+        if (name == key) {
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<std::string_view> Request::path_param(std::string_view key) const {
+    for (const auto& [name, value] : impl_->req_.path_params) {
+        if (name == key) {
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<std::string_view> Request::cookie(std::string_view name) const {
+    auto cookies = header("Cookie");
+    if (!cookies) {
+        return std::nullopt;
+    }
+
+    std::string_view remaining = *cookies;
+    while (!remaining.empty()) {
+        size_t end = remaining.find(';');
+        std::string_view pair = remaining.substr(0, end);
+        while (!pair.empty() && pair.front() == ' ') {
+            pair.remove_prefix(1);
+        }
+        size_t equals = pair.find('=');
+        if (equals != std::string_view::npos && pair.substr(0, equals) == name) {
+            return pair.substr(equals + 1);
+        }
+        if (end == std::string_view::npos) {
+            break;
+        }
+        remaining.remove_prefix(end + 1);
+    }
+    return std::nullopt;
+}
+
+std::optional<std::chrono::steady_clock::time_point> Request::deadline() const {
+    return impl_->deadline_;
+}
+
+void Request::for_each_header(const std::function<void(std::string_view, std::string_view)>& visitor) const {
+    for (const auto& [name, value] : impl_->req_.headers) {
+        visitor(name, value);
+    }
+}
+
+class BodyReader::ReaderImpl {
+public:
+    ReaderImpl(const httplib::ContentReader& reader, size_t limit)
+        : reader_(reader), limit_(limit), bytes_read_(0), exceeded_(false), consumed_(false) {}
+
+    const httplib::ContentReader& reader_;
+    const size_t limit_;
+    size_t bytes_read_;
+    bool exceeded_;
+    bool consumed_;
+};
+
+BodyReader::BodyReader(std::unique_ptr<ReaderImpl> impl) : impl_(std::move(impl)) {}
+BodyReader::~BodyReader() = default;
+
+bool BodyReader::read(const Receiver& receiver) {
+    if (impl_->consumed_) {
+        return false;
+    }
+    impl_->consumed_ = true;
+
+    return impl_->reader_([this, &receiver](const char* data, size_t length) {
+        impl_->bytes_read_ += length;
+        if (impl_->limit_ > 0 && impl_->bytes_read_ > impl_->limit_) {
+            impl_->exceeded_ = true;
+            return false;
+        }
+        return receiver(std::string_view(data, length));
+    });
+}
+
+size_t BodyReader::bytes_read() const {
+    return impl_->bytes_read_;
+}
+
+bool BodyReader::limit_exceeded() const {
+    return impl_->exceeded_;
+}
+
+class ResponseWriter::WriterImpl {
+public:
+    WriterImpl(httplib::DataSink& sink) : sink_(sink), failed_(false) {
+        buffer_.reserve(STREAM_BUFFER_SIZE);
+    }
+
+    bool send(std::string_view data) {
+        if (failed_) {
+            return false;
+        }
+        if (!data.empty() && (!sink_.is_writable() || !sink_.write(data.data(), data.size()))) {
+            failed_ = true;
+        }
+        return !failed_;
+    }
+
+    httplib::DataSink& sink_;
+    std::string buffer_;
+    bool failed_;
+};
+
+ResponseWriter::ResponseWriter(std::unique_ptr<WriterImpl> impl) : impl_(std::move(impl)) {}
+ResponseWriter::~ResponseWriter() = default;
+
+bool ResponseWriter::write(std::string_view data) {
+    if (impl_->failed_) {
+        return false;
+    }
+    if (impl_->buffer_.size() + data.size() > STREAM_BUFFER_SIZE) {
+        if (!flush()) {
+            return false;
+        }
+        if (data.size() >= STREAM_BUFFER_SIZE) {
+            return impl_->send(data);
+        }
+    }
+    impl_->buffer_.append(data);
+    return true;
+}
+
+bool ResponseWriter::flush() {
+    bool sent = impl_->send(impl_->buffer_);
+    impl_->buffer_.clear();
+    return sent;
+}
+
 // Response Implementation
 class Response::ResponseImpl {
 public:
-    ResponseImpl() : res_(nullptr) {}
-    ResponseImpl(httplib::Response& res) : res_(&res) {}
+    ResponseImpl() : res_(nullptr), has_view_(false), streaming_(false) {}
+    ResponseImpl(httplib::Response& res) : res_(&res), has_view_(false), streaming_(false) {}
+
+    void set_view(std::string_view view, std::shared_ptr<const std::string> owner) {
+        view_ = view;
+        owner_ = std::move(owner);
+        has_view_ = true;
+    }
+
+    void clear_view() {
+        view_ = {};
+        owner_.reset();
+        has_view_ = false;
+        streaming_ = false;
+    }
+
+    std::string_view body() const {
+        return has_view_ ? view_ : std::string_view(res_->body);
+    }
+
+    // Borrowed bodies are handed to httplib as a content provider once the
+    // handler is done, so they are written to the socket without a copy.
+    void commit() {
+        if (!has_view_) {
+            return;
+        }
+
+        std::string content_type = res_->get_header_value("Content-Type");
+        erase_header(*res_, "Content-Type");
+        res_->set_content_provider(view_.size(), content_type,
+            [view = view_, owner = owner_](size_t offset, size_t length, httplib::DataSink& sink) {
+                return sink.write(view.data() + offset, length);
+            });
+        clear_view();
+    }
+
     httplib::Response* res_;
+    std::shared_ptr<const std::string> owner_;
+    std::string_view view_;
+    bool has_view_;
+    bool streaming_;
 };
 
 Response::Response() : impl_(std::make_unique<ResponseImpl>()) {}
+Response::Response(std::unique_ptr<ResponseImpl> impl) : impl_(std::move(impl)) {}
 Response::~Response() = default;
 
 void Response::set_content(const std::string& content, const std::string& content_type) {
     if (impl_->res_ != nullptr) {
+        impl_->clear_view();
         impl_->res_->set_content(content, content_type);
     }
 }
 
+void Response::set_content(std::string&& content, const std::string& content_type) {
+    if (impl_->res_ != nullptr) {
+        impl_->clear_view();
+        impl_->res_->set_content(std::move(content), content_type);
+    }
+}
+
+void Response::set_content(SharedBuffer content, const std::string& content_type) {
+    if (impl_->res_ == nullptr) {
+        return;
+    }
+    if (!content) {
+        set_content(std::string(), content_type);
+        return;
+    }
+
+    impl_->res_->body.clear();
+    erase_header(*impl_->res_, "Content-Type");
+    impl_->res_->set_header("Content-Type", content_type);
+    std::string_view view(*content);
+    impl_->set_view(view, std::move(content));
+}
+
+void Response::set_content_view(std::string_view content, const std::string& content_type) {
+    if (impl_->res_ == nullptr) {
+        return;
+    }
+
+    impl_->res_->body.clear();
+    erase_header(*impl_->res_, "Content-Type");
+    impl_->res_->set_header("Content-Type", content_type);
+    impl_->set_view(content, nullptr);
+}
+
+void Response::set_chunked_content(const std::string& content_type, ChunkedContentProvider provider) {
+    if (impl_->res_ == nullptr) {
+        return;
+    }
+
+    impl_->clear_view();
+    impl_->streaming_ = true;
+    impl_->res_->set_chunked_content_provider(content_type,
+        [provider = std::move(provider)](size_t /*offset*/, httplib::DataSink& sink) {
+            ResponseWriter writer(std::make_unique<ResponseWriter::WriterImpl>(sink));
+            try {
+                provider(writer);
+            } catch (const std::exception&) {
+                return false;
+            }
+            if (!writer.flush()) {
+                return false;
+            }
+            sink.done();
+            return true;
+        });
+}
+
 void Response::set_header(const std::string& key, const std::string& value) {
     if (impl_->res_ != nullptr) {
         impl_->res_->set_header(key, value);
@@ -53,6 +402,316 @@ void Response::set_status(int status) {
     }
 }
 
+class MiddlewareChain {
+public:
+    using Step = std::variant<HTTPServer::BeforeMiddleware, HTTPServer::AfterMiddleware, HTTPServer::AroundMiddleware>;
+
+    MiddlewareChain() = default;
+    explicit MiddlewareChain(std::vector<Step> steps) : steps_(std::move(steps)) {}
+
+    void run(size_t index, const HTTPServer::Handler& handler, const Request& req, Response& res) const {
+        if (index == steps_.size()) {
+            handler(req, res);
+            return;
+        }
+
+        const Step& step = steps_[index];
+        if (const auto* before = std::get_if<HTTPServer::BeforeMiddleware>(&step)) {
+            if ((*before)(req, res)) {
+                run(index + 1, handler, req, res);
+            }
+        } else if (const auto* after = std::get_if<HTTPServer::AfterMiddleware>(&step)) {
+            run(index + 1, handler, req, res);
+            (*after)(req, res);
+        } else {
+            std::get<HTTPServer::AroundMiddleware>(step)(req, res, Next(*this, index + 1, handler, req, res));
+        }
+    }
+
+private:
+    std::vector<Step> steps_;
+};
+
+Next::Next(const MiddlewareChain& chain, size_t index, const HTTPServer::Handler& handler,
+           const Request& req, Response& res)
+    : chain_(chain), index_(index), handler_(handler), req_(req), res_(res) {}
+
+void Next::operator()() const {
+    chain_.run(index_, handler_, req_, res_);
+}
+
+// Worker pool behind httplib's accept loop. A worker that parks inside an async
+// handler calls begin_blocking(), which starts a spare worker when none is idle,
+// so the number of workers able to pick up connections stays at the target.
+// A spare that then sits idle for SPARE_WORKER_IDLE_TIMEOUT while more than the
+// target are unblocked exits again.
+class ConnectionQueue : public httplib::TaskQueue {
+public:
+    ConnectionQueue(size_t threads, size_t max_threads, size_t max_connections, std::atomic<size_t>& connections,
+                    ServerMetrics* metrics)
+        : target_(threads), max_threads_(std::max(threads, max_threads)), max_connections_(max_connections),
+          connections_(connections), metrics_(metrics) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < target_; ++i) {
+            spawn_worker();
+        }
+    }
+
+    ~ConnectionQueue() override {
+        shutdown();
+    }
+
+    bool enqueue(std::function<void()> task) override {
+        size_t active = connections_.fetch_add(1) + 1;
+        if (max_connections_ > 0 && active > max_connections_) {
+            connections_.fetch_sub(1);
+            return false;
+        }
+
+        auto queued_at = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (shutdown_) {
+                connections_.fetch_sub(1);
+                return false;
+            }
+            tasks_.push_back([this, task = std::move(task), queued_at] {
+                queue_wait_ = std::chrono::steady_clock::now() - queued_at;
+                if (metrics_ != nullptr) {
+                    metrics_->record_queue_wait(*queue_wait_);
+                }
+                task();
+                connections_.fetch_sub(1);
+            });
+        }
+        ready_.notify_one();
+        return true;
+    }
+
+    void shutdown() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (shutdown_) {
+                return;
+            }
+            shutdown_ = true;
+        }
+        ready_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+        for (auto& worker : retired_) {
+            worker.join();
+        }
+    }
+
+    void begin_blocking() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++blocked_;
+        add_spare_worker();
+    }
+
+    // For work that holds its worker until a client leaves. Such work may only
+    // take the spares above target_, so that target_ workers always remain for
+    // other connections; returns false once every spare is taken.
+    bool try_begin_blocking() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (blocked_ >= max_threads_ - target_) {
+            return false;
+        }
+        ++blocked_;
+        add_spare_worker();
+        return true;
+    }
+
+    void end_blocking() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --blocked_;
+    }
+
+    static ConnectionQueue* current() {
+        return current_;
+    }
+
+    // How long the connection now being served on this thread waited for a
+    // worker. Only its first request sees the wait, later ones get nothing.
+    static std::optional<std::chrono::steady_clock::duration> take_queue_wait() {
+        return std::exchange(queue_wait_, std::nullopt);
+    }
+
+private:
+    void spawn_worker() {
+        for (auto& worker : retired_) {
+            worker.join();
+        }
+        retired_.clear();
+        workers_.emplace_back([this] { run_worker(); });
+    }
+
+    // Called with the lock held by a worker that is about to return. Its thread
+    // is joined by the next spawn_worker() or by shutdown().
+    void retire_current_worker() {
+        auto self = std::find_if(workers_.begin(), workers_.end(),
+                                 [](const std::thread& worker) { return worker.get_id() == std::this_thread::get_id(); });
+        retired_.push_back(std::move(*self));
+        workers_.erase(self);
+    }
+
+    void add_spare_worker() {
+        if (idle_ == 0 && workers_.size() - blocked_ < target_ && workers_.size() < max_threads_ && !shutdown_) {
+            spawn_worker();
+        }
+    }
+
+    void run_worker() {
+        current_ = this;
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ++idle_;
+                bool ready = ready_.wait_for(lock, SPARE_WORKER_IDLE_TIMEOUT, [this] { return shutdown_ || !tasks_.empty(); });
+                --idle_;
+                if (!ready) {
+                    if (workers_.size() - blocked_ > target_) {
+                        retire_current_worker();
+                        return;
+                    }
+                    continue;
+                }
+                if (tasks_.empty()) {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    static thread_local ConnectionQueue* current_;
+    static thread_local std::optional<std::chrono::steady_clock::duration> queue_wait_;
+
+    const size_t target_;
+    const size_t max_threads_;
+    const size_t max_connections_;
+    std::atomic<size_t>& connections_;
+    ServerMetrics* metrics_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::function<void()>> tasks_;
+    std::list<std::thread> workers_;
+    std::vector<std::thread> retired_;
+    size_t idle_ = 0;
+    size_t blocked_ = 0;
+    bool shutdown_ = false;
+};
+
+thread_local ConnectionQueue* ConnectionQueue::current_ = nullptr;
+thread_local std::optional<std::chrono::steady_clock::duration> ConnectionQueue::queue_wait_;
+
+// An async handler works on its own copies of the request and response, shared
+// with its completion, so that the worker can stop waiting for it without the
+// handler writing into a response that has already been sent.
+struct ParkedRequest {
+    ParkedRequest(const httplib::Request& req, const std::string& req_body, const httplib::Response& res)
+        : request(req), body(req_body), response(res) {}
+
+    httplib::Request request;
+    std::string body;
+    httplib::Response response;
+    std::unique_ptr<Request> wrapped_request;
+    std::unique_ptr<Response> wrapped_response;
+    std::mutex mutex;
+    std::condition_variable done;
+    bool complete = false;
+    std::optional<std::chrono::steady_clock::time_point> abandon_at;
+};
+
+class ClientLimiter {
+public:
+    explicit ClientLimiter(size_t limit) : limit_(limit) {}
+
+    bool acquire(const std::string& client) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t& active = active_[client];
+        if (active >= limit_) {
+            return false;
+        }
+        ++active;
+        return true;
+    }
+
+    void release(const std::string& client) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = active_.find(client);
+        if (found != active_.end() && --found->second == 0) {
+            active_.erase(found);
+        }
+    }
+
+private:
+    const size_t limit_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, size_t> active_;
+};
+
+struct ServerSettings {
+    std::optional<size_t> keep_alive_max_count;
+    std::optional<std::chrono::seconds> keep_alive_timeout;
+    std::optional<std::chrono::microseconds> read_timeout;
+    std::optional<std::chrono::microseconds> write_timeout;
+    std::optional<size_t> payload_max_length;
+    size_t worker_threads = std::max(MIN_WORKER_THREADS, std::thread::hardware_concurrency());
+    size_t max_worker_threads = 0;
+    size_t max_connections = 0;
+    size_t max_connections_per_ip = 0;
+    bool reuse_port = false;
+};
+
+enum class RouteMethod {
+    Get,
+    Post,
+    Put,
+    Delete
+};
+
+const char* method_name(RouteMethod method) {
+    switch (method) {
+        case RouteMethod::Get:
+            return "GET";
+        case RouteMethod::Post:
+            return "POST";
+        case RouteMethod::Put:
+            return "PUT";
+        case RouteMethod::Delete:
+            return "DELETE";
+    }
+    return "";
+}
+
+struct Route {
+    RouteMethod method;
+    std::string path;
+    HTTPServer::Handler handler;
+    HTTPServer::StreamingHandler streaming_handler;
+};
+
+struct RouteRateLimit {
+    explicit RouteRateLimit(const RateLimitOptions& options)
+        : key_header(options.key_header), limiter(options.requests_per_second, options.burst) {}
+    std::string key_header;
+    RateLimiter limiter;
+};
+
+struct RouteContext {
+    RouteMetrics* metrics = nullptr;
+    RoutePriority priority = RoutePriority::Normal;
+    RouteRateLimit* rate_limit = nullptr;
+};
+
+using Deadline = std::optional<std::chrono::steady_clock::time_point>;
+
 class HTTPServer::HTTPServerImpl {
 public:
     HTTPServerImpl() 
@@ -60,16 +719,654 @@ public:
         , port_(DEFAULT_PORT)
         , address_(DEFAULT_ADDRESS) {}
 
+    // Declared first so that it outlives the SSL server that calls back into it.
+    std::unique_ptr<TlsContext> tls_;
     std::unique_ptr<httplib::Server> server_;
     int port_;
     std::string address_;
+    ServerSettings settings_;
+    std::atomic<size_t> connections_{0};
+    std::atomic<bool> draining_{false};
+    std::atomic<bool> stopping_{false};
+    std::vector<std::shared_ptr<EventBroadcaster>> broadcasters_;
+    std::mutex parked_mutex_;
+    std::unordered_set<ParkedRequest*> parked_;
+    std::optional<std::chrono::steady_clock::time_point> abandon_parked_at_;
+    std::unique_ptr<ClientLimiter> client_limiter_;
+    std::unique_ptr<ServerMetrics> metrics_;
+    std::string metrics_path_;
+    std::unique_ptr<CompressionOptions> compression_;
+    std::unique_ptr<CompressedVariantCache> variant_cache_;
+    MiddlewareChain middleware_;
+    std::unique_ptr<AdmissionOptions> admission_;
+    std::unique_ptr<ConcurrencyLimiter> limiter_;
+    std::map<std::string, RoutePriority> priorities_;
+    std::map<std::string, std::unique_ptr<RouteRateLimit>> rate_limits_;
+
+    struct RouteCache {
+        explicit RouteCache(const CacheOptions& cache_options) : options(cache_options), cache(cache_options.max_bytes) {}
+        CacheOptions options;
+        ResponseCache cache;
+    };
+    std::vector<std::unique_ptr<RouteCache>> route_caches_;
+
+    void apply_settings() {
+        if (tls_) {
+            auto server = std::make_unique<httplib::SSLServer>([this](SSL_CTX& ctx) { return tls_->configure(ctx); });
+            if (!server->is_valid()) {
+                throw std::runtime_error("Failed to configure TLS context");
+            }
+            server_ = std::move(server);
+        }
+        if (settings_.keep_alive_max_count) {
+            server_->set_keep_alive_max_count(*settings_.keep_alive_max_count);
+        }
+        if (settings_.keep_alive_timeout) {
+            server_->set_keep_alive_timeout(settings_.keep_alive_timeout->count());
+        }
+        if (settings_.read_timeout) {
+            auto seconds = std::chrono::duration_cast<std::chrono::seconds>(*settings_.read_timeout);
+            server_->set_read_timeout(seconds.count(), (*settings_.read_timeout - seconds).count());
+        }
+        if (settings_.write_timeout) {
+            auto seconds = std::chrono::duration_cast<std::chrono::seconds>(*settings_.write_timeout);
+            server_->set_write_timeout(seconds.count(), (*settings_.write_timeout - seconds).count());
+        }
+        if (settings_.payload_max_length) {
+            server_->set_payload_max_length(*settings_.payload_max_length);
+        }
+        if (settings_.max_connections_per_ip > 0) {
+            client_limiter_ = std::make_unique<ClientLimiter>(settings_.max_connections_per_ip);
+        }
+
+        if (settings_.reuse_port) {
+            server_->set_socket_options([](httplib::socket_t sock) {
+                int enabled = 1;
+                setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+                setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &enabled, sizeof(enabled));
+            });
+        }
+
+        server_->new_task_queue = [this] {
+            size_t threads = std::max<size_t>(settings_.worker_threads, 1);
+            size_t max_threads = settings_.max_worker_threads > 0 ? settings_.max_worker_threads : threads * ASYNC_WORKER_FACTOR;
+            return new ConnectionQueue(threads, max_threads, settings_.max_connections, connections_, metrics_.get());
+        };
+    }
+
+    void install_routes(const std::vector<Route>& routes, const std::map<std::string, CacheOptions>& caches,
+                        const std::map<std::string, size_t>& body_limits) {
+        for (const auto& route : routes) {
+            Handler handler = route.handler;
+            auto cached = caches.find(route.path);
+            if (route.method == RouteMethod::Get && cached != caches.end()) {
+                route_caches_.push_back(std::make_unique<RouteCache>(cached->second));
+                RouteCache* route_cache = route_caches_.back().get();
+                handler = [this, route_cache, inner = std::move(handler)](const Request& req, Response& res) {
+                    serve_cached(*route_cache, inner, req, res);
+                };
+            }
+
+            RouteContext context;
+            context.metrics = metrics_ ? &metrics_->add_route(method_name(route.method), route.path) : nullptr;
+            auto priority = priorities_.find(route.path);
+            if (priority != priorities_.end()) {
+                context.priority = priority->second;
+            }
+            auto rate_limit = rate_limits_.find(route.path);
+            if (rate_limit != rate_limits_.end()) {
+                context.rate_limit = rate_limit->second.get();
+            }
+            auto limit = body_limits.find(route.path);
+            size_t body_limit = limit != body_limits.end() ? limit->second : 0;
+            if (route.method != RouteMethod::Get && (route.streaming_handler || body_limit > 0)) {
+                install_reader_route(route, std::move(handler), body_limit, context);
+                continue;
+            }
+
+            httplib::Server::Handler wrapped = [this, handler = std::move(handler), context](const httplib::Request& req, httplib::Response& res) {
+                wrap_handler(handler, context, req, res, req.body);
+            };
+
+            switch (route.method) {
+                case RouteMethod::Get:
+                    server_->Get(route.path, std::move(wrapped));
+                    break;
+                case RouteMethod::Post:
+                    server_->Post(route.path, std::move(wrapped));
+                    break;
+                case RouteMethod::Put:
+                    server_->Put(route.path, std::move(wrapped));
+                    break;
+                case RouteMethod::Delete:
+                    server_->Delete(route.path, std::move(wrapped));
+                    break;
+            }
+        }
 
-    static void wrap_handler(const Handler& handler, const httplib::Request& req, httplib::Response& res) {
-        Request wrapped_req;
-        wrapped_req.impl_ = std::make_unique<Request::RequestImpl>(req);
-        Response wrapped_res;
-        wrapped_res.impl_ = std::make_unique<Response::ResponseImpl>(res);
-        handler(wrapped_req, wrapped_res);
+        if (metrics_ && !metrics_path_.empty()) {
+            server_->Get(metrics_path_, [this](const httplib::Request& /*req*/, httplib::Response& res) {
+                res.set_content(metrics_->render_prometheus(connections_), "text/plain; version=0.0.4");
+            });
+        }
+    }
+
+    // Routes that stream their body, or cap it, read it through httplib's content
+    // reader so an oversized upload is refused before it is buffered.
+    void install_reader_route(const Route& route, Handler handler, size_t body_limit, RouteContext context) {
+        httplib::Server::HandlerWithContentReader wrapped =
+            [this, handler = std::move(handler), streaming = route.streaming_handler, body_limit, context](
+                const httplib::Request& req, httplib::Response& res, const httplib::ContentReader& content_reader) {
+                auto length = declared_length(req);
+                if (body_limit > 0 && length && *length > body_limit) {
+                    // Small bodies are drained so closing the socket does not reset the 413 in flight.
+                    if (*length <= MAX_DISCARDED_BODY) {
+                        content_reader([](const char* /*data*/, size_t /*length*/) { return true; });
+                    }
+                    reject_upload(context, req, res, HTTP_PAYLOAD_TOO_LARGE, "Payload Too Large");
+                    return;
+                }
+
+                BodyReader body_reader(std::make_unique<BodyReader::ReaderImpl>(content_reader, body_limit));
+                if (streaming) {
+                    Handler inner = [&streaming, &body_reader](const Request& wrapped_req, Response& wrapped_res) {
+                        streaming(wrapped_req, wrapped_res, body_reader);
+                    };
+                    wrap_handler(inner, context, req, res, req.body);
+                } else {
+                    std::string body;
+                    if (!body_reader.read([&body](std::string_view chunk) {
+                            body.append(chunk);
+                            return true;
+                        })) {
+                        reject_upload(context, req, res, body_reader.limit_exceeded() ? HTTP_PAYLOAD_TOO_LARGE : HTTP_BAD_REQUEST,
+                                      body_reader.limit_exceeded() ? "Payload Too Large" : "Bad Request");
+                        return;
+                    }
+                    wrap_handler(handler, context, req, res, body);
+                }
+
+                if (body_reader.limit_exceeded()) {
+                    reject_request(res, HTTP_PAYLOAD_TOO_LARGE, "Payload Too Large");
+                } else if (!body_reader.impl_->consumed_) {
+                    erase_header(res, "Connection");
+                    res.set_header("Connection", "close");
+                }
+            };
+
+        switch (route.method) {
+            case RouteMethod::Post:
+                server_->Post(route.path, std::move(wrapped));
+                break;
+            case RouteMethod::Put:
+                server_->Put(route.path, std::move(wrapped));
+                break;
+            case RouteMethod::Delete:
+                server_->Delete(route.path, std::move(wrapped));
+                break;
+            case RouteMethod::Get:
+                break;
+        }
+    }
+
+    // Uploads refused before the handler runs still go through dispatch, so
+    // rate limits, middleware and route metrics see them like any other response.
+    void reject_upload(const RouteContext& context, const httplib::Request& req, httplib::Response& res, int status,
+                       const char* message) const {
+        Handler reject = [status, message](const Request& /*wrapped_req*/, Response& wrapped_res) {
+            wrapped_res.set_status(status);
+            wrapped_res.set_content(message, "text/plain");
+        };
+        wrap_handler(reject, context, req, res, std::string());
+        erase_header(res, "Connection");
+        res.set_header("Connection", "close");
+    }
+
+    void wrap_handler(const Handler& handler, const RouteContext& context, const httplib::Request& req,
+                      httplib::Response& res, const std::string& body) const {
+        if (context.metrics == nullptr) {
+            admit(handler, context, req, res, body);
+            return;
+        }
+
+        auto started = std::chrono::steady_clock::now();
+        admit(handler, context, req, res, body);
+        size_t bytes_in = body.empty() ? declared_length(req).value_or(0) : body.size();
+        size_t bytes_out = res.body.empty() ? res.content_length_ : res.body.size();
+        context.metrics->record(res.status == -1 ? HTTP_OK : res.status, std::chrono::steady_clock::now() - started,
+                                bytes_in, bytes_out);
+    }
+
+    void admit(const Handler& handler, const RouteContext& context, const httplib::Request& req, httplib::Response& res,
+               const std::string& body) const {
+        if (context.rate_limit != nullptr && !take_token(*context.rate_limit, req, res)) {
+            return;
+        }
+        if (!limiter_) {
+            limit_client(handler, req, res, body, std::nullopt);
+            return;
+        }
+
+        auto started = std::chrono::steady_clock::now();
+        // A budget no longer than the wait connections usually spend queued is
+        // shed up front: under that load the request is unlikely to be answered
+        // in time, and the work would be wasted.
+        Deadline deadline = request_deadline(req, started);
+        if (deadline && *deadline - started <= metrics_->expected_queue_wait()) {
+            shed_request(res, "Deadline exceeded");
+            return;
+        }
+        if (!limiter_->try_acquire(context.priority)) {
+            shed_request(res, "Server overloaded");
+            return;
+        }
+        try {
+            limit_client(handler, req, res, body, deadline);
+        } catch (...) {
+            limiter_->release(std::chrono::steady_clock::now() - started);
+            throw;
+        }
+        limiter_->release(std::chrono::steady_clock::now() - started);
+    }
+
+    Deadline request_deadline(const httplib::Request& req, std::chrono::steady_clock::time_point now) const {
+        auto queue_wait = ConnectionQueue::take_queue_wait();
+        auto header = req.headers.find(admission_->deadline_header);
+        if (header == req.headers.end()) {
+            return std::nullopt;
+        }
+        int64_t budget_ms = 0;
+        const std::string& value = header->second;
+        auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), budget_ms);
+        if (ec != std::errc() || budget_ms < 0) {
+            return std::nullopt;
+        }
+        return now - queue_wait.value_or(std::chrono::steady_clock::duration::zero()) + std::chrono::milliseconds(budget_ms);
+    }
+
+    static bool take_token(RouteRateLimit& rate_limit, const httplib::Request& req, httplib::Response& res) {
+        std::string_view key = req.remote_addr;
+        if (!rate_limit.key_header.empty()) {
+            auto header = req.headers.find(rate_limit.key_header);
+            if (header != req.headers.end()) {
+                key = header->second;
+            }
+        }
+
+        auto wait = rate_limit.limiter.acquire(key);
+        if (!wait) {
+            return true;
+        }
+        auto retry_after = std::max<int64_t>(1, std::chrono::ceil<std::chrono::seconds>(*wait).count());
+        res.status = HTTP_TOO_MANY_REQUESTS;
+        res.set_header("Retry-After", std::to_string(retry_after));
+        res.set_content("Too Many Requests", "text/plain");
+        return false;
+    }
+
+    static void shed_request(httplib::Response& res, const char* message) {
+        res.status = HTTP_SERVICE_UNAVAILABLE;
+        res.set_header("Retry-After", std::to_string(HTTP_SERVICE_UNAVAILABLE_RETRY_SECONDS));
+        res.set_content(message, "text/plain");
+    }
+
+    void limit_client(const Handler& handler, const httplib::Request& req, httplib::Response& res,
+                      const std::string& body, Deadline deadline) const {
+        if (client_limiter_) {
+            if (!client_limiter_->acquire(req.remote_addr)) {
+                res.status = HTTP_SERVICE_UNAVAILABLE;
+                res.set_header("Connection", "close");
+                res.set_content("Too many concurrent requests", "text/plain");
+                return;
+            }
+            try {
+                dispatch(handler, req, res, body, deadline);
+            } catch (...) {
+                client_limiter_->release(req.remote_addr);
+                throw;
+            }
+            client_limiter_->release(req.remote_addr);
+            return;
+        }
+        dispatch(handler, req, res, body, deadline);
+    }
+
+    void dispatch(const Handler& handler, const httplib::Request& req, httplib::Response& res, const std::string& body,
+                  Deadline deadline) const {
+        Request wrapped_req(std::make_unique<Request::RequestImpl>(req, body));
+        wrapped_req.impl_->deadline_ = deadline;
+        Response wrapped_res(std::make_unique<Response::ResponseImpl>(res));
+        middleware_.run(0, handler, wrapped_req, wrapped_res);
+
+        if (compression_) {
+            compress_response(req, *wrapped_res.impl_);
+        }
+        wrapped_res.impl_->commit();
+
+        if (draining_) {
+            erase_header(res, "Connection");
+            res.set_header("Connection", "close");
+        }
+    }
+
+    bool drain(std::chrono::milliseconds deadline) {
+        auto until = std::chrono::steady_clock::now() + deadline;
+        draining_ = true;
+        abandon_parked(until);
+        end_event_streams();
+        server_->stop();
+
+        while (connections_ > 0) {
+            if (std::chrono::steady_clock::now() >= until) {
+                return false;
+            }
+            std::this_thread::sleep_for(DRAIN_POLL_INTERVAL);
+        }
+        return true;
+    }
+
+    Handler park_until_complete(AsyncHandler handler) {
+        return [this, handler = std::move(handler)](const Request& req, Response& res) {
+            auto parked = std::make_shared<ParkedRequest>(req.impl_->req_, req.impl_->body_, *res.impl_->res_);
+            parked->wrapped_request.reset(new Request(std::make_unique<Request::RequestImpl>(parked->request, parked->body)));
+            parked->wrapped_request->impl_->deadline_ = req.impl_->deadline_;
+            parked->wrapped_response.reset(new Response(std::make_unique<Response::ResponseImpl>(*res.impl_)));
+            parked->wrapped_response->impl_->res_ = &parked->response;
+
+            handler(*parked->wrapped_request, *parked->wrapped_response, [parked] {
+                std::lock_guard<std::mutex> lock(parked->mutex);
+                parked->complete = true;
+                parked->done.notify_all();
+            });
+
+            if (!wait_for_completion(*parked, req.impl_->deadline_)) {
+                bool expired = req.impl_->deadline_ && std::chrono::steady_clock::now() >= *req.impl_->deadline_;
+                res.set_status(HTTP_SERVICE_UNAVAILABLE);
+                res.set_header("Retry-After", std::to_string(HTTP_SERVICE_UNAVAILABLE_RETRY_SECONDS));
+                res.set_content(expired ? "Deadline exceeded" : "Server shutting down", "text/plain");
+                return;
+            }
+
+            // done() has been called, so the handler no longer touches its copies.
+            httplib::Response* target = res.impl_->res_;
+            *target = std::move(parked->response);
+            *res.impl_ = *parked->wrapped_response->impl_;
+            res.impl_->res_ = target;
+        };
+    }
+
+    // Parks the worker until the handler calls done(), the request's deadline
+    // passes or the server gives up on parked requests while stopping. Returns
+    // whether the handler completed.
+    bool wait_for_completion(ParkedRequest& parked, Deadline deadline) {
+        {
+            std::lock_guard<std::mutex> lock(parked.mutex);
+            if (parked.complete) {
+                return true;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(parked_mutex_);
+            parked_.insert(&parked);
+            std::lock_guard<std::mutex> parked_lock(parked.mutex);
+            parked.abandon_at = abandon_parked_at_;
+        }
+        ConnectionQueue* queue = ConnectionQueue::current();
+        if (queue != nullptr) {
+            queue->begin_blocking();
+        }
+
+        bool complete = false;
+        {
+            std::unique_lock<std::mutex> lock(parked.mutex);
+            while (!parked.complete) {
+                Deadline until = deadline;
+                if (parked.abandon_at && (!until || *parked.abandon_at < *until)) {
+                    until = parked.abandon_at;
+                }
+                if (!until) {
+                    parked.done.wait(lock);
+                } else if (parked.done.wait_until(lock, *until) == std::cv_status::timeout) {
+                    break;
+                }
+            }
+            complete = parked.complete;
+        }
+
+        if (queue != nullptr) {
+            queue->end_blocking();
+        }
+        std::lock_guard<std::mutex> lock(parked_mutex_);
+        parked_.erase(&parked);
+        return complete;
+    }
+
+    // Requests parked in async handlers, now or later, are answered with 503 at
+    // the latest by the given time.
+    void abandon_parked(std::chrono::steady_clock::time_point at) {
+        std::lock_guard<std::mutex> lock(parked_mutex_);
+        abandon_parked_at_ = at;
+        for (ParkedRequest* parked : parked_) {
+            std::lock_guard<std::mutex> parked_lock(parked->mutex);
+            parked->abandon_at = at;
+            parked->done.notify_all();
+        }
+    }
+
+    Handler event_stream(std::shared_ptr<EventBroadcaster> broadcaster) {
+        broadcasters_.push_back(broadcaster);
+        return [this, broadcaster = std::move(broadcaster)](const Request& /*req*/, Response& res) {
+            // The worker is reserved before the response starts, so that a
+            // subscriber over the spare-worker budget can still be refused. The
+            // reservation ends when the provider is destroyed, whether or not
+            // it ever ran.
+            std::shared_ptr<ConnectionQueue> reserved;
+            if (ConnectionQueue* queue = ConnectionQueue::current()) {
+                if (!queue->try_begin_blocking()) {
+                    res.set_status(HTTP_SERVICE_UNAVAILABLE);
+                    res.set_header("Retry-After", std::to_string(HTTP_SERVICE_UNAVAILABLE_RETRY_SECONDS));
+                    res.set_content("Too many event stream subscribers", "text/plain");
+                    return;
+                }
+                reserved.reset(queue, [](ConnectionQueue* owner) { owner->end_blocking(); });
+            }
+
+            res.set_header("Cache-Control", "no-cache");
+            res.set_header("X-Accel-Buffering", "no");
+            res.set_chunked_content("text/event-stream", [this, broadcaster, reserved](ResponseWriter& writer) {
+                EventBroadcaster::BroadcasterImpl& events = *broadcaster->impl_;
+                uint64_t cursor = events.subscribe();
+
+                std::vector<EventBroadcaster::BroadcasterImpl::Event> batch;
+                if (writer.write(": connected\n\n") && writer.flush()) {
+                    while (events.wait(cursor, batch, EVENT_HEARTBEAT_INTERVAL, stopping_)) {
+                        bool written = batch.empty() ? writer.write(": keep-alive\n\n") : true;
+                        for (const auto& event : batch) {
+                            written = written && writer.write(*event);
+                        }
+                        batch.clear();
+                        if (!written || !writer.flush()) {
+                            break;
+                        }
+                    }
+                }
+
+                events.unsubscribe();
+            });
+        };
+    }
+
+    void end_event_streams() {
+        stopping_ = true;
+        for (const auto& broadcaster : broadcasters_) {
+            broadcaster->impl_->wake();
+        }
+    }
+
+    static std::string cache_key(const CacheOptions& options, const httplib::Request& req) {
+        std::string key = req.path;
+        if (options.include_query) {
+            for (const auto& [name, value] : req.params) {
+                key += '\n';
+                key += name;
+                key += '=';
+                key += value;
+            }
+        }
+        for (const auto& header : options.vary_headers) {
+            key += '\n';
+            key += header;
+            key += ':';
+            key += req.get_header_value(header);
+        }
+        return key;
+    }
+
+    // Only headers the handler added are stored: the ones already present were
+    // set by middleware for this particular request and run again on a hit.
+    static std::shared_ptr<const CachedResponse> capture_response(const CacheOptions& options, Response::ResponseImpl& body,
+                                                                  httplib::Headers before) {
+        httplib::Response& res = *body.res_;
+        if ((res.status != -1 && res.status != HTTP_OK) || body.streaming_) {
+            return nullptr;
+        }
+
+        std::vector<std::pair<std::string, std::string>> added;
+        for (const auto& [name, value] : res.headers) {
+            auto [first, last] = before.equal_range(name);
+            auto same = std::find_if(first, last, [&value](const auto& header) { return header.second == value; });
+            if (same != last) {
+                before.erase(same);
+            } else if (iequals(name, "Set-Cookie")) {
+                return nullptr;
+            } else {
+                added.emplace_back(name, value);
+            }
+        }
+
+        auto entry = std::make_shared<CachedResponse>();
+        entry->status = HTTP_OK;
+        entry->content_type = res.get_header_value("Content-Type");
+
+        if (body.has_view_ && body.owner_ && body.owner_->size() == body.view_.size()) {
+            entry->body = body.owner_;
+        } else {
+            entry->body = std::make_shared<const std::string>(body.has_view_ ? std::string(body.view_) : std::move(res.body));
+            res.body.clear();
+            body.set_view(*entry->body, entry->body);
+        }
+
+        if (!res.has_header("ETag")) {
+            res.set_header("ETag", weak_etag(*entry->body));
+            added.emplace_back("ETag", res.get_header_value("ETag"));
+        }
+        for (auto& [name, value] : added) {
+            if (!iequals(name, "Content-Type") && !iequals(name, "Content-Length")) {
+                entry->headers.emplace_back(std::move(name), std::move(value));
+            }
+        }
+
+        entry->fresh_until = CachedResponse::Clock::now() + options.ttl;
+        entry->stale_until = entry->fresh_until + options.stale_while_revalidate;
+        return entry;
+    }
+
+    static void write_cached(const CachedResponse& entry, Response& res) {
+        res.set_status(entry.status);
+        for (const auto& [name, value] : entry.headers) {
+            res.set_header(name, value);
+        }
+        res.set_content(entry.body, entry.content_type);
+    }
+
+    void serve_cached(RouteCache& route_cache, const Handler& handler, const Request& req, Response& res) const {
+        std::string key = cache_key(route_cache.options, req.impl_->req_);
+        auto ticket = route_cache.cache.acquire(key);
+        if (ticket.entry) {
+            write_cached(*ticket.entry, res);
+            return;
+        }
+        if (!ticket.leader) {
+            handler(req, res);
+            return;
+        }
+
+        httplib::Headers before = res.impl_->res_->headers;
+        try {
+            handler(req, res);
+        } catch (...) {
+            route_cache.cache.publish(key, nullptr);
+            throw;
+        }
+        route_cache.cache.publish(key, capture_response(route_cache.options, *res.impl_, std::move(before)));
+    }
+
+    bool is_compressible(const std::string& content_type) const {
+        std::string_view media_type(content_type);
+        media_type = media_type.substr(0, media_type.find(';'));
+        for (const auto& allowed : compression_->content_types) {
+            bool prefix = !allowed.empty() && allowed.back() == '/';
+            if (prefix ? media_type.starts_with(allowed) : media_type == allowed) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void compress_response(const httplib::Request& req, Response::ResponseImpl& body) const {
+        httplib::Response& res = *body.res_;
+        std::string_view content = body.body();
+        if (content.empty() || res.has_header("Content-Encoding") || !is_compressible(res.get_header_value("Content-Type"))) {
+            return;
+        }
+
+        add_vary(res, "Accept-Encoding");
+        NegotiatedEncoding negotiated = negotiate_encoding(req.get_header_value("Accept-Encoding"));
+        ContentEncoding encoding = negotiated.encoding;
+        // Small bodies and poor ratios are only sent compressed when the client
+        // refused the identity coding.
+        if (encoding == ContentEncoding::Identity ||
+            (negotiated.identity_acceptable && content.size() < compression_->min_size)) {
+            return;
+        }
+
+        std::string cache_key;
+        if (variant_cache_ && res.has_header("ETag")) {
+            cache_key = req.path + '\n' + res.get_header_value("ETag") + '\n' + encoding_token(encoding);
+            if (auto cached = variant_cache_->find(cache_key)) {
+                res.body.clear();
+                body.set_view(*cached, cached);
+                set_content_encoding(res, encoding);
+                return;
+            }
+        }
+
+        std::string compressed;
+        if (!compress_body(encoding, content, compression_->level, compressed) ||
+            (negotiated.identity_acceptable && compressed.size() >= content.size())) {
+            return;
+        }
+
+        if (!cache_key.empty()) {
+            auto shared = std::make_shared<const std::string>(std::move(compressed));
+            variant_cache_->insert(cache_key, shared);
+            res.body.clear();
+            body.set_view(*shared, shared);
+        } else {
+            body.clear_view();
+            res.body.swap(compressed);
+        }
+        set_content_encoding(res, encoding);
+    }
+
+    // The encoded body is a different byte sequence, so a strong validator from
+    // the handler no longer holds for it and is downgraded to a weak one.
+    static void set_content_encoding(httplib::Response& res, ContentEncoding encoding) {
+        res.set_header("Content-Encoding", encoding_token(encoding));
+        auto etag = res.headers.find("ETag");
+        if (etag != res.headers.end() && !etag->second.starts_with("W/")) {
+            etag->second = "W/" + etag->second;
+        }
     }
 };
 
@@ -80,55 +1377,116 @@ HTTPServer::~HTTPServer()
 }
 
 void HTTPServer::start() {
+    impl_->stopping_ = false;
+    impl_->draining_ = false;
+    {
+        std::lock_guard<std::mutex> lock(impl_->parked_mutex_);
+        impl_->abandon_parked_at_.reset();
+    }
     if (!impl_->server_->listen(impl_->address_, impl_->port_)) {
         throw std::runtime_error("Failed to start server on " + impl_->address_ + ":" + std::to_string(impl_->port_));
     }
 }
 
 void HTTPServer::stop() {
+    impl_->end_event_streams();
+    impl_->abandon_parked(std::chrono::steady_clock::now());
     if (impl_->server_) {
         impl_->server_->stop();
     }
 }
 
+bool HTTPServer::shutdown(std::chrono::milliseconds deadline) {
+    return impl_->drain(deadline);
+}
+
+void HTTPServer::reload_certificates() {
+    if (!impl_->tls_) {
+        throw std::runtime_error("TLS is not enabled on this server");
+    }
+    impl_->tls_->reload();
+}
+
 class HTTPServer::Builder::BuilderImpl {
 public:
     BuilderImpl() : server_(new HTTPServer()) {}
     std::unique_ptr<HTTPServer> server_;
+    std::vector<Route> routes_;
+    std::vector<MiddlewareChain::Step> middleware_;
+    std::map<std::string, CacheOptions> caches_;
+    std::map<std::string, size_t> body_limits_;
 };
 
 HTTPServer::Builder::Builder() : impl_(std::make_unique<BuilderImpl>()) {}
 HTTPServer::Builder::~Builder() = default;
 
 HTTPServer::Builder& HTTPServer::Builder::get(const std::string& path, const Handler& handler) {
-    impl_->server_->impl_->server_->Get(path, 
-        [handler](const httplib::Request& req, httplib::Response& res) {
-            HTTPServerImpl::wrap_handler(handler, req, res);
-        });
+    impl_->routes_.push_back({RouteMethod::Get, path, handler, nullptr});
     return *this;
 }
 
 HTTPServer::Builder& HTTPServer::Builder::post(const std::string& path, const Handler& handler) {
-    impl_->server_->impl_->server_->Post(path,
-        [handler](const httplib::Request& req, httplib::Response& res) {
-            HTTPServerImpl::wrap_handler(handler, req, res);
-        });
+    impl_->routes_.push_back({RouteMethod::Post, path, handler, nullptr});
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::post(const std::string& path, const StreamingHandler& handler) {
+    impl_->routes_.push_back({RouteMethod::Post, path, nullptr, handler});
     return *this;
 }
 
 HTTPServer::Builder& HTTPServer::Builder::put(const std::string& path, const Handler& handler) {
-    impl_->server_->impl_->server_->Put(path,
-        [handler](const httplib::Request& req, httplib::Response& res) {
-            HTTPServerImpl::wrap_handler(handler, req, res);
-        });
+    impl_->routes_.push_back({RouteMethod::Put, path, handler, nullptr});
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::put(const std::string& path, const StreamingHandler& handler) {
+    impl_->routes_.push_back({RouteMethod::Put, path, nullptr, handler});
     return *this;
 }
 
 HTTPServer::Builder& HTTPServer::Builder::del(const std::string& path, const Handler& handler) {
-    impl_->server_->impl_->server_->Delete(path,
-        [handler](const httplib::Request& req, httplib::Response& res) {
-            HTTPServerImpl::wrap_handler(handler, req, res);
-        });
+    impl_->routes_.push_back({RouteMethod::Delete, path, handler, nullptr});
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::get_async(const std::string& path, const AsyncHandler& handler) {
+    impl_->routes_.push_back({RouteMethod::Get, path, impl_->server_->impl_->park_until_complete(handler), nullptr});
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::post_async(const std::string& path, const AsyncHandler& handler) {
+    impl_->routes_.push_back({RouteMethod::Post, path, impl_->server_->impl_->park_until_complete(handler), nullptr});
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::put_async(const std::string& path, const AsyncHandler& handler) {
+    impl_->routes_.push_back({RouteMethod::Put, path, impl_->server_->impl_->park_until_complete(handler), nullptr});
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::del_async(const std::string& path, const AsyncHandler& handler) {
+    impl_->routes_.push_back({RouteMethod::Delete, path, impl_->server_->impl_->park_until_complete(handler), nullptr});
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::events(const std::string& path, std::shared_ptr<EventBroadcaster> broadcaster) {
+    impl_->routes_.push_back({RouteMethod::Get, path, impl_->server_->impl_->event_stream(std::move(broadcaster)), nullptr});
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::before(const BeforeMiddleware& middleware) {
+    impl_->middleware_.emplace_back(middleware);
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::after(const AfterMiddleware& middleware) {
+    impl_->middleware_.emplace_back(middleware);
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::around(const AroundMiddleware& middleware) {
+    impl_->middleware_.emplace_back(middleware);
     return *this;
 }
 
@@ -142,7 +1500,117 @@ HTTPServer::Builder& HTTPServer::Builder::address(const std::string& addr) {
     return *this;
 }
 
+HTTPServer::Builder& HTTPServer::Builder::compression(const CompressionOptions& options) {
+    HTTPServerImpl* server = impl_->server_->impl_.get();
+    server->compression_ = std::make_unique<CompressionOptions>(options);
+    server->variant_cache_.reset();
+    if (options.variant_cache_bytes > 0) {
+        server->variant_cache_ = std::make_unique<CompressedVariantCache>(options.variant_cache_bytes);
+    }
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::cache(const std::string& path, const CacheOptions& options) {
+    impl_->caches_[path] = options;
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::keep_alive_max_count(size_t count) {
+    impl_->server_->impl_->settings_.keep_alive_max_count = count;
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::keep_alive_timeout(std::chrono::seconds timeout) {
+    impl_->server_->impl_->settings_.keep_alive_timeout = timeout;
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::read_timeout(std::chrono::microseconds timeout) {
+    impl_->server_->impl_->settings_.read_timeout = timeout;
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::write_timeout(std::chrono::microseconds timeout) {
+    impl_->server_->impl_->settings_.write_timeout = timeout;
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::payload_max_length(size_t length) {
+    impl_->server_->impl_->settings_.payload_max_length = length;
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::worker_threads(size_t count) {
+    impl_->server_->impl_->settings_.worker_threads = count;
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::max_worker_threads(size_t count) {
+    impl_->server_->impl_->settings_.max_worker_threads = count;
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::max_connections(size_t count) {
+    impl_->server_->impl_->settings_.max_connections = count;
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::max_connections_per_ip(size_t count) {
+    impl_->server_->impl_->settings_.max_connections_per_ip = count;
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::reuse_port(bool enabled) {
+    impl_->server_->impl_->settings_.reuse_port = enabled;
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::metrics(const std::string& path) {
+    HTTPServerImpl* server = impl_->server_->impl_.get();
+    if (!server->metrics_) {
+        server->metrics_ = std::make_unique<ServerMetrics>();
+    }
+    server->metrics_path_ = path;
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::admission_control(const AdmissionOptions& options) {
+    HTTPServerImpl* server = impl_->server_->impl_.get();
+    server->admission_ = std::make_unique<AdmissionOptions>(options);
+    server->limiter_ = std::make_unique<ConcurrencyLimiter>(options);
+    // Deadlines are checked against the recorded queue waits, which are kept
+    // even when no metrics endpoint is served.
+    if (!server->metrics_) {
+        server->metrics_ = std::make_unique<ServerMetrics>();
+    }
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::priority(const std::string& path, RoutePriority priority) {
+    impl_->server_->impl_->priorities_[path] = priority;
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::rate_limit(const std::string& path, const RateLimitOptions& options) {
+    impl_->server_->impl_->rate_limits_[path] = std::make_unique<RouteRateLimit>(options);
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::tls(const TlsOptions& options) {
+    impl_->server_->impl_->tls_ = std::make_unique<TlsContext>(options);
+    return *this;
+}
+
+HTTPServer::Builder& HTTPServer::Builder::max_body_size(const std::string& path, size_t bytes) {
+    impl_->body_limits_[path] = bytes;
+    return *this;
+}
+
 std::unique_ptr<HTTPServer> HTTPServer::Builder::build() {
+    HTTPServerImpl& server = *impl_->server_->impl_;
+    server.apply_settings();
+    server.middleware_ = MiddlewareChain(std::move(impl_->middleware_));
+    server.install_routes(impl_->routes_, impl_->caches_, impl_->body_limits_);
     return std::move(impl_->server_);
 }
 
@@ -0,0 +1,74 @@
+#include "output_writer.h"
+#include <atomic>
+#include <cerrno>
+#include <string>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cppwebforge {
+
+namespace {
+std::atomic<unsigned long> temporaryCounter{0};
+
+[[noreturn]] void throwWriteError(const std::filesystem::path& path, int error) {
+    throw TemplateError("Failed to write output file " + path.string() + ": " +
+                        std::error_code(error, std::generic_category()).message());
+}
+
+bool writeAll(int fd, std::string_view content) {
+    while (!content.empty()) {
+        ssize_t written = ::write(fd, content.data(), content.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        content.remove_prefix(static_cast<size_t>(written));
+    }
+    return true;
+}
+
+void syncDirectory(const std::filesystem::path& directory) {
+    int fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        throwWriteError(directory, errno);
+    }
+    int result = ::fsync(fd);
+    int error = errno;
+    ::close(fd);
+    if (result != 0) {
+        throwWriteError(directory, error);
+    }
+}
+}
+
+void writeFileAtomically(const std::filesystem::path& path, std::string_view content,
+                         TemplateRenderer::SyncPolicy sync) {
+    auto temporary = path.parent_path() / ("." + path.filename().string() + ".tmp." + std::to_string(::getpid()) + "." +
+                                           std::to_string(temporaryCounter.fetch_add(1, std::memory_order_relaxed)));
+
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        throwWriteError(path, errno);
+    }
+
+    bool written = writeAll(fd, content) && (sync == TemplateRenderer::SyncPolicy::None || ::fsync(fd) == 0);
+    int error = errno;
+    if (::close(fd) != 0 && written) {
+        written = false;
+        error = errno;
+    }
+    if (!written || ::rename(temporary.c_str(), path.c_str()) != 0) {
+        error = written ? errno : error;
+        ::unlink(temporary.c_str());
+        throwWriteError(path, error);
+    }
+
+    if (sync == TemplateRenderer::SyncPolicy::FileAndDirectory) {
+        syncDirectory(path.parent_path());
+    }
+}
+
+} // namespace cppwebforge
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "template_renderer.h"
+#include <filesystem>
+#include <string_view>
+
+namespace cppwebforge {
+
+// Writes content to a temporary file next to path with a single write call
+// and renames it over path, so that path never holds a partial file. Throws
+// TemplateError on failure and leaves no temporary file behind.
+void writeFileAtomically(const std::filesystem::path& path, std::string_view content,
+                         TemplateRenderer::SyncPolicy sync);
+
+} // namespace cppwebforge
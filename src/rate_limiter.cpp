@@ -0,0 +1,150 @@
+#include "rate_limiter.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cppwebforge {
+
+namespace {
+constexpr size_t LIMITER_SHARDS = 32;
+constexpr int64_t WHEEL_SLOTS = 64;
+constexpr int64_t MIN_TICK_NANOS = 1000000;
+
+int64_t now_nanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct KeyHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view key) const {
+        return std::hash<std::string_view>{}(key);
+    }
+};
+}
+
+class RateLimiter::LimiterImpl {
+public:
+    LimiterImpl(double requests_per_second, double burst)
+        : interval_(static_cast<int64_t>(1e9 / std::max(requests_per_second, 1e-9))),
+          tolerance_(static_cast<int64_t>(static_cast<double>(interval_) * std::max(burst, 1.0))),
+          tick_(std::max<int64_t>(MIN_TICK_NANOS, tolerance_ / (WHEEL_SLOTS - 1))) {
+        int64_t now = now_nanos();
+        for (auto& shard : shards_) {
+            shard.current_tick = now / tick_;
+        }
+    }
+
+    std::optional<std::chrono::nanoseconds> acquire(std::string_view key) {
+        size_t hash = KeyHash{}(key);
+        Shard& shard = shards_[hash % LIMITER_SHARDS];
+        int64_t now = now_nanos();
+
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            auto found = shard.buckets.find(key);
+            if (found != shard.buckets.end()) {
+                return take(found->second, now);
+            }
+        }
+
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        sweep(shard, now);
+        auto [bucket, inserted] = shard.buckets.try_emplace(std::string(key));
+        if (inserted) {
+            schedule(shard, bucket->first, now);
+        }
+        return take(bucket->second, now);
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& shard : shards_) {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            total += shard.buckets.size();
+        }
+        return total;
+    }
+
+private:
+    struct Bucket {
+        std::atomic<int64_t> arrival{0};
+    };
+
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, Bucket, KeyHash, std::equal_to<>> buckets;
+        std::array<std::vector<std::string>, WHEEL_SLOTS> wheel;
+        int64_t current_tick = 0;
+    };
+
+    std::optional<std::chrono::nanoseconds> take(Bucket& bucket, int64_t now) const {
+        int64_t arrival = bucket.arrival.load(std::memory_order_relaxed);
+        for (;;) {
+            int64_t next = std::max(arrival, now) + interval_;
+            int64_t allowed_at = next - tolerance_;
+            if (allowed_at > now) {
+                return std::chrono::nanoseconds(allowed_at - now);
+            }
+            if (bucket.arrival.compare_exchange_weak(arrival, next, std::memory_order_relaxed)) {
+                return std::nullopt;
+            }
+        }
+    }
+
+    void schedule(Shard& shard, const std::string& key, int64_t now) const {
+        int64_t due = (now + tolerance_) / tick_ + 1;
+        int64_t ahead = std::clamp<int64_t>(due - shard.current_tick, 1, WHEEL_SLOTS - 1);
+        shard.wheel[(shard.current_tick + ahead) % WHEEL_SLOTS].push_back(key);
+    }
+
+    // A bucket whose arrival time has passed is full again and behaves exactly
+    // like a missing one, so it can be dropped; the others are rescheduled.
+    void sweep(Shard& shard, int64_t now) const {
+        int64_t target = now / tick_;
+        int64_t steps = std::min<int64_t>(target - shard.current_tick, WHEEL_SLOTS);
+        shard.current_tick = std::max(shard.current_tick, target - steps);
+        for (int64_t step = 0; step < steps; ++step) {
+            ++shard.current_tick;
+            std::vector<std::string> due = std::move(shard.wheel[shard.current_tick % WHEEL_SLOTS]);
+            shard.wheel[shard.current_tick % WHEEL_SLOTS].clear();
+            for (auto& key : due) {
+                auto found = shard.buckets.find(key);
+                if (found == shard.buckets.end()) {
+                    continue;
+                }
+                if (found->second.arrival.load(std::memory_order_relaxed) <= now) {
+                    shard.buckets.erase(found);
+                } else {
+                    schedule(shard, key, now);
+                }
+            }
+        }
+    }
+
+    const int64_t interval_;
+    const int64_t tolerance_;
+    const int64_t tick_;
+    std::array<Shard, LIMITER_SHARDS> shards_;
+};
+
+RateLimiter::RateLimiter(double requests_per_second, double burst)
+    : impl_(std::make_unique<LimiterImpl>(requests_per_second, burst)) {}
+
+RateLimiter::~RateLimiter() = default;
+
+std::optional<std::chrono::nanoseconds> RateLimiter::acquire(std::string_view key) {
+    return impl_->acquire(key);
+}
+
+size_t RateLimiter::size() const {
+    return impl_->size();
+}
+
+} // namespace cppwebforge
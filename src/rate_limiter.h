@@ -0,0 +1,31 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+namespace cppwebforge {
+
+// Token buckets keyed by client, kept as a single theoretical arrival time per
+// key (GCRA) so that taking a token is one compare-and-swap under a shared
+// shard lock. Each shard runs a timing wheel spanning one full refill that drops
+// buckets once they are full again, so memory follows the recently active keys.
+class RateLimiter {
+public:
+    RateLimiter(double requests_per_second, double burst);
+    ~RateLimiter();
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // Takes a token for key, or returns how long until one is available.
+    std::optional<std::chrono::nanoseconds> acquire(std::string_view key);
+    size_t size() const;
+
+private:
+    class LimiterImpl;
+    std::unique_ptr<LimiterImpl> impl_;
+};
+
+} // namespace cppwebforge
@@ -0,0 +1,173 @@
+#include "response_cache.h"
+#include <array>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace cppwebforge {
+
+namespace {
+constexpr size_t CACHE_SHARDS = 16;
+}
+
+size_t CachedResponse::size() const {
+    size_t total = content_type.size() + (body ? body->size() : 0);
+    for (const auto& [key, value] : headers) {
+        total += key.size() + value.size();
+    }
+    return total;
+}
+
+class ResponseCache::CacheImpl {
+public:
+    explicit CacheImpl(size_t max_bytes) : shard_bytes_(max_bytes / CACHE_SHARDS) {}
+
+    Ticket acquire(const std::string& key) {
+        Shard& shard = shard_for(key);
+        auto now = CachedResponse::Clock::now();
+
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            auto found = shard.entries.find(key);
+            if (found != shard.entries.end()) {
+                if (auto ticket = serve(found->second.entry, now)) {
+                    return *ticket;
+                }
+            }
+        }
+
+        std::shared_ptr<Flight> flight;
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            auto found = shard.entries.find(key);
+            if (found != shard.entries.end()) {
+                if (auto ticket = serve(found->second.entry, now)) {
+                    return *ticket;
+                }
+            }
+
+            auto pending = shard.flights.find(key);
+            if (pending == shard.flights.end()) {
+                shard.flights.emplace(key, std::make_shared<Flight>());
+                return {nullptr, true};
+            }
+            flight = pending->second;
+        }
+
+        std::unique_lock<std::mutex> lock(flight->mutex);
+        flight->ready.wait(lock, [&flight] { return flight->done; });
+        return {flight->result, false};
+    }
+
+    void publish(const std::string& key, std::shared_ptr<const CachedResponse> entry) {
+        Shard& shard = shard_for(key);
+        std::shared_ptr<Flight> flight;
+
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            auto pending = shard.flights.find(key);
+            if (pending != shard.flights.end()) {
+                flight = pending->second;
+                shard.flights.erase(pending);
+            }
+
+            auto found = shard.entries.find(key);
+            if (!entry) {
+                if (found != shard.entries.end()) {
+                    found->second.entry->refreshing = false;
+                }
+            } else {
+                if (found != shard.entries.end()) {
+                    remove(shard, found);
+                }
+                insert(shard, key, entry);
+            }
+        }
+
+        if (flight) {
+            std::lock_guard<std::mutex> lock(flight->mutex);
+            flight->result = std::move(entry);
+            flight->done = true;
+            flight->ready.notify_all();
+        }
+    }
+
+private:
+    struct Flight {
+        std::mutex mutex;
+        std::condition_variable ready;
+        bool done = false;
+        std::shared_ptr<const CachedResponse> result;
+    };
+
+    struct Slot {
+        std::shared_ptr<const CachedResponse> entry;
+        std::list<std::string>::iterator order;
+        size_t size;
+    };
+
+    struct Shard {
+        std::shared_mutex mutex;
+        std::unordered_map<std::string, Slot> entries;
+        std::unordered_map<std::string, std::shared_ptr<Flight>> flights;
+        std::list<std::string> order;
+        size_t bytes = 0;
+    };
+
+    static std::optional<Ticket> serve(const std::shared_ptr<const CachedResponse>& entry,
+                                         CachedResponse::Clock::time_point now) {
+        if (now < entry->fresh_until) {
+            return Ticket{entry, false};
+        }
+        if (now < entry->stale_until) {
+            bool leader = !entry->refreshing.exchange(true);
+            return Ticket{leader ? nullptr : entry, leader};
+        }
+        return std::nullopt;
+    }
+
+    Shard& shard_for(const std::string& key) {
+        return shards_[std::hash<std::string>{}(key) % CACHE_SHARDS];
+    }
+
+    static void remove(Shard& shard, std::unordered_map<std::string, Slot>::iterator slot) {
+        shard.bytes -= slot->second.size;
+        shard.order.erase(slot->second.order);
+        shard.entries.erase(slot);
+    }
+
+    void insert(Shard& shard, const std::string& key, const std::shared_ptr<const CachedResponse>& entry) {
+        size_t size = key.size() + entry->size();
+        if (size > shard_bytes_) {
+            return;
+        }
+
+        while (shard.bytes + size > shard_bytes_ && !shard.order.empty()) {
+            remove(shard, shard.entries.find(shard.order.front()));
+        }
+
+        shard.order.push_back(key);
+        shard.entries.emplace(key, Slot{entry, std::prev(shard.order.end()), size});
+        shard.bytes += size;
+    }
+
+    const size_t shard_bytes_;
+    std::array<Shard, CACHE_SHARDS> shards_;
+};
+
+ResponseCache::ResponseCache(size_t max_bytes) : impl_(std::make_unique<CacheImpl>(max_bytes)) {}
+ResponseCache::~ResponseCache() = default;
+
+ResponseCache::Ticket ResponseCache::acquire(const std::string& key) {
+    return impl_->acquire(key);
+}
+
+void ResponseCache::publish(const std::string& key, std::shared_ptr<const CachedResponse> entry) {
+    impl_->publish(key, std::move(entry));
+}
+
+} // namespace cppwebforge
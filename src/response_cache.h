@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cppwebforge {
+
+struct CachedResponse {
+    using Clock = std::chrono::steady_clock;
+
+    int status = 0;
+    std::string content_type;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::shared_ptr<const std::string> body;
+    Clock::time_point fresh_until;
+    Clock::time_point stale_until;
+    mutable std::atomic<bool> refreshing{false};
+
+    size_t size() const;
+};
+
+// Sharded map of cached responses. Lookups take a shared lock on one shard
+// only; misses are collapsed so that a single caller recomputes a key while
+// the others wait for its result or keep serving the stale entry.
+class ResponseCache {
+public:
+    struct Ticket {
+        std::shared_ptr<const CachedResponse> entry;
+        bool leader = false;
+    };
+
+    explicit ResponseCache(size_t max_bytes);
+    ~ResponseCache();
+
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+
+    Ticket acquire(const std::string& key);
+    void publish(const std::string& key, std::shared_ptr<const CachedResponse> entry);
+
+private:
+    class CacheImpl;
+    std::unique_ptr<CacheImpl> impl_;
+};
+
+} // namespace cppwebforge
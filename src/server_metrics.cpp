@@ -0,0 +1,188 @@
+#include "server_metrics.h"
+#include <bit>
+
+namespace cppwebforge {
+
+namespace {
+constexpr double MICROS_PER_SECOND = 1e6;
+constexpr int STATUS_CLASS_DIVISOR = 100;
+
+std::string escape_label(const std::string& value) {
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (char character : value) {
+        if (character == '\\' || character == '"') {
+            escaped += '\\';
+        }
+        escaped += character;
+    }
+    return escaped;
+}
+
+void write_histogram(std::string& out, const std::string& name, const std::string& labels,
+                     const std::array<uint64_t, LatencyHistogram::BUCKET_COUNT>& counts, uint64_t sum_micros) {
+    std::string prefix = labels.empty() ? "{" : "{" + labels + ",";
+    uint64_t cumulative = 0;
+    for (size_t octave = 0; octave < LatencyHistogram::MAX_OCTAVE; ++octave) {
+        for (size_t sub = 0; sub < LatencyHistogram::SUB_BUCKETS; ++sub) {
+            cumulative += counts[octave * LatencyHistogram::SUB_BUCKETS + sub];
+        }
+        // Octave o ends at 2^(o + 2) microseconds.
+        double upper = static_cast<double>(uint64_t{1} << (octave + 2)) / MICROS_PER_SECOND;
+        out += name + "_bucket" + prefix + "le=\"" + std::to_string(upper) + "\"} " + std::to_string(cumulative) + "\n";
+    }
+    out += name + "_bucket" + prefix + "le=\"+Inf\"} " + std::to_string(cumulative) + "\n";
+    std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+    out += name + "_sum" + suffix + " " + std::to_string(static_cast<double>(sum_micros) / MICROS_PER_SECOND) + "\n";
+    out += name + "_count" + suffix + " " + std::to_string(cumulative) + "\n";
+}
+}
+
+size_t LatencyHistogram::bucket_index(uint64_t micros) {
+    if (micros < SUB_BUCKETS) {
+        return micros;
+    }
+    size_t msb = std::bit_width(micros) - 1;
+    size_t sub = (micros >> (msb - 2)) & (SUB_BUCKETS - 1);
+    size_t index = (msb - 1) * SUB_BUCKETS + sub;
+    return index < BUCKET_COUNT ? index : BUCKET_COUNT - 1;
+}
+
+uint64_t LatencyHistogram::bucket_upper_micros(size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index + 1;
+    }
+    size_t msb = index / SUB_BUCKETS + 1;
+    size_t sub = index % SUB_BUCKETS;
+    return uint64_t{SUB_BUCKETS + sub + 1} << (msb - 2);
+}
+
+void LatencyHistogram::record(std::chrono::nanoseconds elapsed) {
+    auto micros = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    buckets_[bucket_index(micros)].fetch_add(1, std::memory_order_relaxed);
+    sum_micros_.fetch_add(micros, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::merge_into(std::array<uint64_t, BUCKET_COUNT>& counts, uint64_t& sum_micros) const {
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        counts[i] += buckets_[i].load(std::memory_order_relaxed);
+    }
+    sum_micros += sum_micros_.load(std::memory_order_relaxed);
+}
+
+RouteMetrics::RouteMetrics(const std::string& method, const std::string& route)
+    : labels_("method=\"" + escape_label(method) + "\",route=\"" + escape_label(route) + "\"") {}
+
+void RouteMetrics::record(int status, std::chrono::nanoseconds elapsed, size_t bytes_in, size_t bytes_out) {
+    Shard& shard = shards_[ServerMetrics::thread_shard()];
+    shard.latency.record(elapsed);
+
+    int status_class = status / STATUS_CLASS_DIVISOR;
+    if (status_class >= 1 && status_class <= static_cast<int>(STATUS_CLASSES)) {
+        shard.status_classes[status_class - 1].fetch_add(1, std::memory_order_relaxed);
+    }
+    shard.bytes_in.fetch_add(bytes_in, std::memory_order_relaxed);
+    shard.bytes_out.fetch_add(bytes_out, std::memory_order_relaxed);
+}
+
+void RouteMetrics::write_requests(std::string& out) const {
+    for (size_t status_class = 0; status_class < STATUS_CLASSES; ++status_class) {
+        uint64_t total = 0;
+        for (const auto& shard : shards_) {
+            total += shard.status_classes[status_class].load(std::memory_order_relaxed);
+        }
+        out += "cppwebforge_requests_total{" + labels_ + ",status=\"" + std::to_string(status_class + 1) + "xx\"} " +
+               std::to_string(total) + "\n";
+    }
+}
+
+void RouteMetrics::write_bytes(std::string& out, const char* name, bool incoming) const {
+    uint64_t total = 0;
+    for (const auto& shard : shards_) {
+        total += (incoming ? shard.bytes_in : shard.bytes_out).load(std::memory_order_relaxed);
+    }
+    out += std::string(name) + "{" + labels_ + "} " + std::to_string(total) + "\n";
+}
+
+void RouteMetrics::write_latency(std::string& out) const {
+    std::array<uint64_t, LatencyHistogram::BUCKET_COUNT> counts{};
+    uint64_t sum_micros = 0;
+    for (const auto& shard : shards_) {
+        shard.latency.merge_into(counts, sum_micros);
+    }
+    write_histogram(out, "cppwebforge_request_duration_seconds", labels_, counts, sum_micros);
+}
+
+RouteMetrics& ServerMetrics::add_route(const std::string& method, const std::string& route) {
+    routes_.push_back(std::make_unique<RouteMetrics>(method, route));
+    return *routes_.back();
+}
+
+void ServerMetrics::record_queue_wait(std::chrono::nanoseconds elapsed) {
+    queue_wait_[thread_shard()].record(elapsed);
+}
+
+size_t ServerMetrics::thread_shard() {
+    static std::atomic<size_t> next_shard{0};
+    thread_local const size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+    return shard;
+}
+
+std::chrono::microseconds ServerMetrics::expected_queue_wait() const {
+    std::array<uint64_t, LatencyHistogram::BUCKET_COUNT> counts{};
+    uint64_t sum_micros = 0;
+    for (const auto& histogram : queue_wait_) {
+        histogram.merge_into(counts, sum_micros);
+    }
+    uint64_t total = 0;
+    for (uint64_t count : counts) {
+        total += count;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size() && total > 0; ++i) {
+        seen += counts[i];
+        if (seen * 2 >= total) {
+            return std::chrono::microseconds(LatencyHistogram::bucket_upper_micros(i));
+        }
+    }
+    return std::chrono::microseconds::zero();
+}
+
+std::string ServerMetrics::render_prometheus(size_t open_connections) const {
+    std::string out;
+
+    out += "# TYPE cppwebforge_requests_total counter\n";
+    for (const auto& route : routes_) {
+        route->write_requests(out);
+    }
+
+    out += "# TYPE cppwebforge_request_duration_seconds histogram\n";
+    for (const auto& route : routes_) {
+        route->write_latency(out);
+    }
+
+    out += "# TYPE cppwebforge_request_bytes_total counter\n";
+    for (const auto& route : routes_) {
+        route->write_bytes(out, "cppwebforge_request_bytes_total", true);
+    }
+
+    out += "# TYPE cppwebforge_response_bytes_total counter\n";
+    for (const auto& route : routes_) {
+        route->write_bytes(out, "cppwebforge_response_bytes_total", false);
+    }
+
+    std::array<uint64_t, LatencyHistogram::BUCKET_COUNT> counts{};
+    uint64_t sum_micros = 0;
+    for (const auto& histogram : queue_wait_) {
+        histogram.merge_into(counts, sum_micros);
+    }
+    out += "# TYPE cppwebforge_connection_queue_seconds histogram\n";
+    write_histogram(out, "cppwebforge_connection_queue_seconds", "", counts, sum_micros);
+
+    out += "# TYPE cppwebforge_open_connections gauge\n";
+    out += "cppwebforge_open_connections " + std::to_string(open_connections) + "\n";
+    return out;
+}
+
+} // namespace cppwebforge
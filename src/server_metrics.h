@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cppwebforge {
+
+constexpr size_t METRIC_SHARDS = 8;
+
+// Log-linear histogram in the spirit of HDR histograms: every power-of-two
+// range of microseconds is split into four buckets, giving ~25% precision.
+class LatencyHistogram {
+public:
+    static constexpr size_t SUB_BUCKETS = 4;
+    static constexpr size_t MAX_OCTAVE = 36;
+    static constexpr size_t BUCKET_COUNT = SUB_BUCKETS * MAX_OCTAVE;
+
+    void record(std::chrono::nanoseconds elapsed);
+    void merge_into(std::array<uint64_t, BUCKET_COUNT>& counts, uint64_t& sum_micros) const;
+
+    static size_t bucket_index(uint64_t micros);
+    static uint64_t bucket_upper_micros(size_t index);
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets_{};
+    std::atomic<uint64_t> sum_micros_{0};
+};
+
+class RouteMetrics {
+public:
+    RouteMetrics(const std::string& method, const std::string& route);
+
+    void record(int status, std::chrono::nanoseconds elapsed, size_t bytes_in, size_t bytes_out);
+
+    const std::string& labels() const { return labels_; }
+    void write_requests(std::string& out) const;
+    void write_bytes(std::string& out, const char* name, bool incoming) const;
+    void write_latency(std::string& out) const;
+
+private:
+    static constexpr size_t STATUS_CLASSES = 5;
+
+    struct alignas(64) Shard {
+        LatencyHistogram latency;
+        std::array<std::atomic<uint64_t>, STATUS_CLASSES> status_classes{};
+        std::atomic<uint64_t> bytes_in{0};
+        std::atomic<uint64_t> bytes_out{0};
+    };
+
+    std::string labels_;
+    std::array<Shard, METRIC_SHARDS> shards_;
+};
+
+// Writers record into the shard owned by their thread, readers merge all
+// shards when the metrics endpoint is scraped.
+class ServerMetrics {
+public:
+    RouteMetrics& add_route(const std::string& method, const std::string& route);
+    void record_queue_wait(std::chrono::nanoseconds elapsed);
+    // Median of the recorded queue waits, rounded up to its bucket's upper
+    // bound; zero before any wait has been recorded.
+    std::chrono::microseconds expected_queue_wait() const;
+    std::string render_prometheus(size_t open_connections) const;
+
+    static size_t thread_shard();
+
+private:
+    std::vector<std::unique_ptr<RouteMetrics>> routes_;
+    std::array<LatencyHistogram, METRIC_SHARDS> queue_wait_;
+};
+
+} // namespace cppwebforge
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <string_view>
+
+namespace cppwebforge {
+
+constexpr uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+
+inline bool iequals(std::string_view lhs, std::string_view rhs) {
+    return lhs.size() == rhs.size() &&
+           std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](char left, char right) {
+               return std::tolower(static_cast<unsigned char>(left)) == std::tolower(static_cast<unsigned char>(right));
+           });
+}
+
+// 64-bit FNV-1a; pass a previous result as hash to continue over more bytes.
+inline uint64_t fnv1a(std::string_view bytes, uint64_t hash = FNV_OFFSET_BASIS) {
+    for (char byte : bytes) {
+        hash ^= static_cast<unsigned char>(byte);
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+} // namespace cppwebforge
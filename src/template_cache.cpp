@@ -0,0 +1,268 @@
+#include "template_cache.h"
+#include "build_manifest.h"
+#include "file_util.h"
+#include "template_renderer.h"
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <system_error>
+
+namespace cppwebforge {
+
+namespace {
+constexpr int MAX_INCLUDE_DEPTH = 64;
+thread_local int includeDepth = 0;
+
+std::string cacheKey(const std::filesystem::path& templatePath) {
+    return templatePath.lexically_normal().string();
+}
+
+// inja stores an include under the path it was parsed with followed by the
+// include name, and looks it up under that name again when rendering. Parsing
+// every template with its own directory keeps includes of the same name from
+// different directories apart. The directory is prefixed with a NUL byte:
+// inja opens include files through c_str(), so its own file lookup never finds
+// one and every include is resolved by the cache's callback.
+std::string includeDirectory(const std::string& key) {
+    std::string directory(1, '\0');
+    std::string parent = std::filesystem::path(key).parent_path().string();
+    if (!parent.empty()) {
+        directory += parent + '/';
+    }
+    return directory;
+}
+
+std::filesystem::path includedPath(const std::string& directory, const std::string& name) {
+    return std::filesystem::path(directory.substr(directory.empty() ? 0 : 1)) / name;
+}
+}
+
+bool CompiledTemplate::isStale(Clock::duration interval) const {
+    Clock::rep now = Clock::now().time_since_epoch().count();
+    if (interval.count() > 0 && now - checkedAt.load(std::memory_order_relaxed) < interval.count()) {
+        return false;
+    }
+    for (const auto& dependency : dependencies) {
+        if (modified_time(dependency.path) != dependency.modified) {
+            return true;
+        }
+    }
+    checkedAt.store(now, std::memory_order_relaxed);
+    return false;
+}
+
+TemplateCache& TemplateCache::shared() {
+    static TemplateCache cache;
+    return cache;
+}
+
+std::shared_ptr<const CompiledTemplate> TemplateCache::get(const std::filesystem::path& templatePath) {
+    std::string key = cacheKey(templatePath);
+    Shard& shard = shardFor(key);
+    CompiledTemplate::Clock::duration interval(revalidationInterval_.load(std::memory_order_relaxed));
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto found = shard.templates.find(key);
+        if (found != shard.templates.end() && !found->second->isStale(interval)) {
+            return found->second;
+        }
+    }
+
+    auto compiled = compile(templatePath, key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.templates[key] = compiled;
+    return compiled;
+}
+
+void TemplateCache::invalidate(const std::filesystem::path& templatePath) {
+    std::string key = cacheKey(templatePath);
+    Shard& shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.templates.erase(key);
+}
+
+void TemplateCache::clear() {
+    for (auto& shard : shards_) {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        shard.templates.clear();
+    }
+}
+
+void TemplateCache::setRevalidationInterval(CompiledTemplate::Clock::duration interval) {
+    revalidationInterval_.store(interval.count(), std::memory_order_relaxed);
+}
+
+void TemplateCache::registerSource(const std::string& name, std::string source) {
+    registerSources({{name, std::move(source)}});
+}
+
+// All sources are stored before any is compiled, so templates registered
+// together may include each other in any order. Entries built from a replaced
+// name, including a file of that name, are dropped. If any source fails to
+// compile, every name is restored to what it was before the call.
+void TemplateCache::registerSources(const std::map<std::string, std::string>& sources) {
+    std::map<std::string, std::optional<std::string>> previous;
+    {
+        std::unique_lock<std::shared_mutex> lock(sourcesMutex_);
+        for (const auto& [name, source] : sources) {
+            std::string key = cacheKey(name);
+            auto found = sources_.find(key);
+            previous.try_emplace(key, found != sources_.end() ? std::optional<std::string>(found->second) : std::nullopt);
+            sources_[key] = source;
+        }
+    }
+    for (const auto& entry : previous) {
+        invalidateDependents(entry.first);
+    }
+
+    try {
+        for (const auto& entry : sources) {
+            get(entry.first);
+        }
+    } catch (...) {
+        {
+            std::unique_lock<std::shared_mutex> lock(sourcesMutex_);
+            for (auto& [key, source] : previous) {
+                if (source) {
+                    sources_[key] = std::move(*source);
+                } else {
+                    sources_.erase(key);
+                }
+            }
+        }
+        for (const auto& entry : previous) {
+            invalidateDependents(entry.first);
+        }
+        throw;
+    }
+}
+
+void TemplateCache::unregisterSource(const std::string& name) {
+    std::string key = cacheKey(name);
+    {
+        std::unique_lock<std::shared_mutex> lock(sourcesMutex_);
+        if (sources_.erase(key) == 0) {
+            return;
+        }
+    }
+    invalidateDependents(key);
+}
+
+size_t TemplateCache::preload(const std::filesystem::path& directory, const std::vector<std::string>& extensions) {
+    std::error_code errorCode;
+    std::filesystem::recursive_directory_iterator entries(directory, errorCode);
+    if (errorCode) {
+        throw TemplateError("Failed to read template directory: " + directory.string() + ": " + errorCode.message());
+    }
+
+    size_t loaded = 0;
+    std::string failures;
+    for (const auto& entry : entries) {
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+        if (!extensions.empty() &&
+            std::find(extensions.begin(), extensions.end(), entry.path().extension().string()) == extensions.end()) {
+            continue;
+        }
+        try {
+            get(entry.path());
+            ++loaded;
+        } catch (const std::exception& e) {
+            failures += "\n" + entry.path().string() + ": " + e.what();
+        }
+    }
+
+    if (!failures.empty()) {
+        throw TemplateError("Failed to preload templates:" + failures);
+    }
+    return loaded;
+}
+
+TemplateCache::Shard& TemplateCache::shardFor(const std::string& key) {
+    return shards_[std::hash<std::string>{}(key) % CACHE_SHARDS];
+}
+
+void TemplateCache::invalidateDependents(const std::string& key) {
+    for (auto& shard : shards_) {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        std::erase_if(shard.templates, [&key](const auto& entry) {
+            const auto& keys = entry.second->templateKeys;
+            return std::find(keys.begin(), keys.end(), key) != keys.end();
+        });
+    }
+}
+
+// Includes are resolved through the cache rather than inja's own file lookup,
+// so an include compiled once is shared by every template using it, and every
+// file a template reads is recorded as a dependency.
+std::shared_ptr<const CompiledTemplate> TemplateCache::compile(const std::filesystem::path& templatePath,
+                                                               const std::string& key) {
+    std::optional<std::string> source;
+    {
+        std::shared_lock<std::shared_mutex> lock(sourcesMutex_);
+        auto found = sources_.find(key);
+        if (found != sources_.end()) {
+            source = found->second;
+        }
+    }
+    std::optional<std::filesystem::file_time_type> modified;
+    if (!source) {
+        modified = modified_time(templatePath);
+        std::ifstream file(templatePath, std::ios::binary);
+        if (!file.is_open()) {
+            throw TemplateError("Template file does not exist: " + templatePath.string());
+        }
+        source = std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    if (includeDepth >= MAX_INCLUDE_DEPTH) {
+        throw TemplateError("Template includes nest too deeply: " + templatePath.string());
+    }
+    ++includeDepth;
+    struct DepthGuard {
+        ~DepthGuard() { --includeDepth; }
+    } depthGuard;
+
+    auto compiled = std::make_shared<CompiledTemplate>();
+    compiled->environment = std::make_unique<inja::Environment>(includeDirectory(key));
+    inja::Environment& environment = *compiled->environment;
+    environment.set_trim_blocks(true);
+    environment.set_lstrip_blocks(true);
+    environment.set_search_included_templates_in_files(true);
+
+    CompiledTemplate& target = *compiled;
+    environment.set_include_callback([this, &environment, &target](const std::string& directory, const std::string& name) {
+        auto included = get(includedPath(directory, name));
+        for (const auto& [nestedName, nested] : included->includes) {
+            environment.include_template(nestedName, nested);
+        }
+        target.includes.insert(target.includes.end(), included->includes.begin(), included->includes.end());
+        target.includes.emplace_back(directory + name, included->root);
+        target.dependencies.insert(target.dependencies.end(), included->dependencies.begin(), included->dependencies.end());
+        target.templateKeys.insert(target.templateKeys.end(), included->templateKeys.begin(), included->templateKeys.end());
+        return included->root;
+    });
+
+    compiled->templateKeys.push_back(key);
+    if (modified) {
+        compiled->dependencies.push_back({templatePath, *modified});
+    }
+    compiled->root = environment.parse(*source);
+    compiled->checkedAt = CompiledTemplate::Clock::now().time_since_epoch().count();
+
+    uint64_t dependencyHash = BuildManifest::hashBytes(compiled->root.content);
+    for (const auto& include : compiled->includes) {
+        dependencyHash = BuildManifest::hashBytes(include.second.content, dependencyHash);
+    }
+    for (const auto& dependency : compiled->dependencies) {
+        dependencyHash = BuildManifest::hashBytes(dependency.path.string(), dependencyHash);
+        dependencyHash = BuildManifest::hashBytes(std::to_string(dependency.modified.time_since_epoch().count()), dependencyHash);
+    }
+    compiled->dependencyHash = dependencyHash;
+    return compiled;
+}
+
+} // namespace cppwebforge
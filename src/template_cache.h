@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <inja/inja.hpp>
+
+namespace cppwebforge {
+
+// A parsed template together with the environment holding its includes.
+// Nothing but the revalidation time is modified once compiled, so renders can
+// share it between threads.
+struct CompiledTemplate {
+    using Clock = std::chrono::steady_clock;
+
+    struct Dependency {
+        std::filesystem::path path;
+        std::filesystem::file_time_type modified;
+    };
+
+    std::unique_ptr<inja::Environment> environment;
+    inja::Template root;
+    std::vector<Dependency> dependencies;
+    // Cache keys of this template and of everything it includes, whether read
+    // from a file or registered from memory.
+    std::vector<std::string> templateKeys;
+    // Every template included directly or indirectly, keyed by the directory
+    // of the including template followed by the include name, so that
+    // including this one elsewhere can reuse them.
+    std::vector<std::pair<std::string, inja::Template>> includes;
+    uint64_t dependencyHash = 0;
+    mutable std::atomic<Clock::rep> checkedAt{0};
+
+    bool isStale(Clock::duration interval) const;
+};
+
+// Process-wide cache of compiled templates keyed by path. An entry is compiled
+// again once the template or any file it includes changes on disk; files are
+// checked at most once per revalidation interval. Lookups take a shared lock
+// on one shard only. Templates registered from memory are looked up by name
+// before the disk, and includes are resolved through the cache as well.
+class TemplateCache {
+public:
+    static TemplateCache& shared();
+
+    std::shared_ptr<const CompiledTemplate> get(const std::filesystem::path& templatePath);
+    void invalidate(const std::filesystem::path& templatePath);
+    void clear();
+    void setRevalidationInterval(CompiledTemplate::Clock::duration interval);
+    void registerSource(const std::string& name, std::string source);
+    void registerSources(const std::map<std::string, std::string>& sources);
+    void unregisterSource(const std::string& name);
+    size_t preload(const std::filesystem::path& directory, const std::vector<std::string>& extensions);
+
+private:
+    static constexpr size_t CACHE_SHARDS = 16;
+
+    struct Shard {
+        std::shared_mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<const CompiledTemplate>> templates;
+    };
+
+    std::shared_ptr<const CompiledTemplate> compile(const std::filesystem::path& templatePath, const std::string& key);
+    Shard& shardFor(const std::string& key);
+    void invalidateDependents(const std::string& key);
+
+    std::array<Shard, CACHE_SHARDS> shards_;
+    std::shared_mutex sourcesMutex_;
+    std::unordered_map<std::string, std::string> sources_;
+    std::atomic<CompiledTemplate::Clock::rep> revalidationInterval_{0};
+};
+
+} // namespace cppwebforge
@@ -1,55 +1,238 @@
 #include "template_renderer.h"
-#include <fstream>
+#include "build_manifest.h"
+#include "compression.h"
+#include "data_document.h"
+#include "output_writer.h"
+#include "template_cache.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <streambuf>
 #include <system_error>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <inja/inja.hpp>
 #include <nlohmann/json.hpp>
 
 namespace cppwebforge {
 
-class TemplateRenderer::TemplateRendererImpl {
+namespace {
+class StringAppendBuffer : public std::streambuf {
+public:
+    explicit StringAppendBuffer(std::string& target) : target_(target) {}
+
+protected:
+    int_type overflow(int_type character) override {
+        if (!traits_type::eq_int_type(character, traits_type::eof())) {
+            target_.push_back(traits_type::to_char_type(character));
+        }
+        return traits_type::not_eof(character);
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize count) override {
+        target_.append(data, static_cast<size_t>(count));
+        return count;
+    }
+
+private:
+    std::string& target_;
+};
+
+struct StreamStopped {};
+
+// Holds at most one chunk of output and hands it to the sink whenever it
+// fills up; writes larger than the buffer go to the sink directly, split into
+// chunks of the buffer's size.
+class SinkBuffer : public std::streambuf {
 public:
-    TemplateRendererImpl() {
-        env_.set_trim_blocks(true);
-        env_.set_lstrip_blocks(true);
-    }
-
-    nlohmann::json convertToJson(const DataValue& value) {
-        if (value.valueless_by_exception()) {
-            throw TemplateError("Invalid variant value");
-        }
-
-        return std::visit([this](const auto& value) -> nlohmann::json {
-            using T = std::decay_t<decltype(value)>;
-            if constexpr (std::is_same_v<T, std::string> ||
-                         std::is_same_v<T, int> ||
-                         std::is_same_v<T, double> ||
-                         std::is_same_v<T, bool>) {
-                return value;
-            } 
-            else if constexpr (std::is_same_v<T, DataMap>) {
-                nlohmann::json obj;
-                for (const auto& [key, val] : value) {
-                    obj[key] = convertToJson(val);
-                }
-                return obj;
-            } 
-            else if constexpr (std::is_same_v<T, DataArray>) {
-                nlohmann::json arr = nlohmann::json::array();
-                for (const auto& element : value) {
-                    arr.push_back(convertToJson(element));
-                }
-                return arr;
+    SinkBuffer(const TemplateRenderer::OutputSink& sink, size_t size)
+        : sink_(sink), buffer_(std::max<size_t>(size, 1)) {
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
+
+    void flush() {
+        size_t pending = static_cast<size_t>(pptr() - pbase());
+        if (pending > 0) {
+            setp(buffer_.data(), buffer_.data() + buffer_.size());
+            deliver(std::string_view(buffer_.data(), pending));
+        }
+    }
+
+protected:
+    int_type overflow(int_type character) override {
+        flush();
+        if (!traits_type::eq_int_type(character, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(character);
+            pbump(1);
+        }
+        return traits_type::not_eof(character);
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize count) override {
+        auto size = static_cast<size_t>(count);
+        if (size <= static_cast<size_t>(epptr() - pptr())) {
+            std::memcpy(pptr(), data, size);
+            pbump(static_cast<int>(size));
+        } else if (size < buffer_.size()) {
+            flush();
+            std::memcpy(pptr(), data, size);
+            pbump(static_cast<int>(size));
+        } else {
+            flush();
+            for (size_t offset = 0; offset < size; offset += buffer_.size()) {
+                deliver(std::string_view(data + offset, std::min(buffer_.size(), size - offset)));
             }
-        }, value);
+        }
+        return count;
+    }
+
+    int sync() override {
+        flush();
+        return 0;
+    }
+
+private:
+    void deliver(std::string_view chunk) {
+        if (!sink_(chunk)) {
+            throw StreamStopped{};
+        }
+    }
+
+    const TemplateRenderer::OutputSink& sink_;
+    std::vector<char> buffer_;
+};
+
+// Threads claim the next unprocessed index as they finish, so slow items
+// do not hold up the rest of the range. The calling thread takes part too.
+template <typename Task>
+void parallelFor(size_t count, size_t threadCount, const Task& task) {
+    std::atomic<size_t> next{0};
+    auto worker = [&next, count, &task] {
+        for (size_t index = next.fetch_add(1, std::memory_order_relaxed); index < count;
+             index = next.fetch_add(1, std::memory_order_relaxed)) {
+            task(index);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threadCount = std::min(threadCount, count);
+    for (size_t i = 1; i < threadCount; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+template <typename Value>
+nlohmann::json convertToJson(Value&& value);
+
+// Maps are already sorted, so every key is appended at the end of the json
+// object instead of being searched for. Rvalue input has its strings moved.
+template <typename Map>
+nlohmann::json convertMap(Map&& map) {
+    nlohmann::json object(nlohmann::json::value_t::object);
+    auto& entries = object.get_ref<nlohmann::json::object_t&>();
+    for (auto& [key, element] : map) {
+        if constexpr (std::is_rvalue_reference_v<Map&&>) {
+            entries.emplace_hint(entries.end(), key, convertToJson(std::move(element)));
+        } else {
+            entries.emplace_hint(entries.end(), key, convertToJson(element));
+        }
+    }
+    return object;
+}
+
+template <typename Array>
+nlohmann::json convertArray(Array&& array) {
+    nlohmann::json result(nlohmann::json::value_t::array);
+    auto& elements = result.get_ref<nlohmann::json::array_t&>();
+    elements.reserve(array.size());
+    for (auto& element : array) {
+        if constexpr (std::is_rvalue_reference_v<Array&&>) {
+            elements.push_back(convertToJson(std::move(element)));
+        } else {
+            elements.push_back(convertToJson(element));
+        }
+    }
+    return result;
+}
+
+template <typename Value>
+nlohmann::json convertToJson(Value&& value) {
+    if (value.valueless_by_exception()) {
+        throw TemplateError("Invalid variant value");
+    }
+
+    return std::visit([](auto&& alternative) -> nlohmann::json {
+        using T = std::decay_t<decltype(alternative)>;
+        if constexpr (std::is_same_v<T, TemplateRenderer::DataMap>) {
+            return convertMap(std::forward<decltype(alternative)>(alternative));
+        } else if constexpr (std::is_same_v<T, TemplateRenderer::DataArray>) {
+            return convertArray(std::forward<decltype(alternative)>(alternative));
+        } else {
+            return std::forward<decltype(alternative)>(alternative);
+        }
+    }, std::forward<Value>(value));
+}
+}
+
+class TemplateRenderer::Context::ContextImpl {
+public:
+    ContextImpl() : data(nlohmann::json::value_t::object) {}
+    explicit ContextImpl(nlohmann::json json) : data(std::move(json)) {}
+    nlohmann::json data;
+};
+
+TemplateRenderer::Context::Context() : impl_(std::make_shared<ContextImpl>()) {}
+TemplateRenderer::Context::Context(const DataMap& data) : impl_(std::make_shared<ContextImpl>(convertMap(data))) {}
+TemplateRenderer::Context::Context(DataMap&& data) : impl_(std::make_shared<ContextImpl>(convertMap(std::move(data)))) {}
+TemplateRenderer::Context::Context(const DataDocument& document)
+    : impl_(std::make_shared<ContextImpl>(document.impl_->toJson())) {}
+TemplateRenderer::Context::~Context() = default;
+
+TemplateRenderer::Context::Context(const Context&) = default;
+TemplateRenderer::Context& TemplateRenderer::Context::operator=(const Context&) = default;
+TemplateRenderer::Context::Context(Context&&) noexcept = default;
+TemplateRenderer::Context& TemplateRenderer::Context::operator=(Context&&) noexcept = default;
+
+void TemplateRenderer::Context::set(const std::string& key, const DataValue& value) {
+    detach();
+    impl_->data[key] = convertToJson(value);
+}
+
+void TemplateRenderer::Context::set(const std::string& key, DataValue&& value) {
+    detach();
+    impl_->data[key] = convertToJson(std::move(value));
+}
+
+void TemplateRenderer::Context::detach() {
+    if (impl_.use_count() > 1) {
+        impl_ = std::make_shared<ContextImpl>(*impl_);
+    }
+}
+
+class TemplateRenderer::TemplateRendererImpl {
+public:
+    TemplateRendererImpl() : cache_(TemplateCache::shared()) {}
+
+    ~TemplateRendererImpl() {
+        try {
+            saveManifest();
+        } catch (const TemplateError&) {
+        }
     }
 
     void renderTemplate(const std::filesystem::path& templatePath,
                        const std::filesystem::path& outputDir,
                        const std::string& outputFilename,
-                       const DataMap& data) {
-        if (!std::filesystem::exists(templatePath)) {
-            throw TemplateError("Template file does not exist: " + templatePath.string());
-        }
+                       const nlohmann::json& data) const {
+        auto compiled = compiledTemplate(templatePath);
 
         std::error_code errorCode;
         if (!std::filesystem::exists(outputDir)) {
@@ -58,31 +241,237 @@ public:
             }
         }
 
-        nlohmann::json jsonData;
-        for (const auto& [key, value] : data) {
-            jsonData[key] = convertToJson(value);
+        writeOutput(*compiled, data, outputDir / outputFilename);
+    }
+
+    BatchResult renderBatch(const std::vector<RenderJob>& jobs,
+                            const std::vector<const nlohmann::json*>& data,
+                            const std::filesystem::path& outputDir,
+                            size_t threadCount) const {
+        if (threadCount == 0) {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
         }
 
-        auto outputPath = outputDir / outputFilename;
+        std::set<std::filesystem::path> directories;
+        std::vector<std::filesystem::path> templatePaths;
+        std::unordered_map<std::string, size_t> templateIndex;
+        std::vector<size_t> jobTemplates;
+        jobTemplates.reserve(jobs.size());
+        for (const auto& job : jobs) {
+            directories.insert((outputDir / job.outputFilename).parent_path());
+            auto [found, inserted] = templateIndex.emplace(job.templatePath.lexically_normal().string(), templatePaths.size());
+            if (inserted) {
+                templatePaths.push_back(job.templatePath);
+            }
+            jobTemplates.push_back(found->second);
+        }
 
-        try {
-            auto result = env_.render_file(templatePath.string(), jsonData);
-            
-            std::ofstream outputFile(outputPath);
-            if (!outputFile.is_open()) {
-                throw TemplateError("Failed to open output file for writing: " + outputPath.string());
+        std::error_code errorCode;
+        std::filesystem::create_directories(outputDir, errorCode);
+        if (errorCode) {
+            throw TemplateError("Failed to create output directory: " + errorCode.message());
+        }
+        // A subdirectory that cannot be created shows up as a failure to open
+        // the output files inside it.
+        for (const auto& directory : directories) {
+            std::filesystem::create_directories(directory, errorCode);
+        }
+
+        std::vector<std::shared_ptr<const CompiledTemplate>> compiled(templatePaths.size());
+        std::vector<std::string> compileErrors(templatePaths.size());
+        parallelFor(templatePaths.size(), threadCount, [&](size_t index) {
+            try {
+                compiled[index] = compiledTemplate(templatePaths[index]);
+            } catch (const std::exception& e) {
+                compileErrors[index] = e.what();
+            }
+        });
+
+        std::vector<std::string> errors(jobs.size());
+        std::vector<Outcome> outcomes(jobs.size(), Outcome::Failed);
+        parallelFor(jobs.size(), threadCount, [&](size_t index) {
+            size_t templateId = jobTemplates[index];
+            if (!compiled[templateId]) {
+                errors[index] = compileErrors[templateId];
+                return;
+            }
+            try {
+                outcomes[index] = writeOutput(*compiled[templateId], *data[index], outputDir / jobs[index].outputFilename);
+            } catch (const std::exception& e) {
+                errors[index] = e.what();
             }
-            
-            outputFile << result;
-            outputFile.close();
-            
+        });
+
+        BatchResult result;
+        for (size_t index = 0; index < jobs.size(); ++index) {
+            switch (outcomes[index]) {
+                case Outcome::Failed:
+                    result.failures.push_back({index, std::move(errors[index])});
+                    break;
+                case Outcome::Skipped:
+                    ++result.skipped;
+                    break;
+                default:
+                    ++result.rendered;
+                    break;
+            }
+        }
+        saveManifest();
+        return result;
+    }
+
+    void useManifest(const std::filesystem::path& manifestPath) {
+        saveManifest();
+        manifest_ = std::make_unique<BuildManifest>(manifestPath);
+    }
+
+    void setOutputOptions(const OutputOptions& options) {
+        outputOptions_ = options;
+    }
+
+    void saveManifest() const {
+        if (manifest_) {
+            manifest_->save();
+        }
+    }
+
+    void renderTo(const std::filesystem::path& templatePath, const nlohmann::json& data, std::ostream& output) const {
+        auto compiled = compiledTemplate(templatePath);
+        try {
+            compiled->environment->render_to(output, compiled->root, data);
+        } catch (const inja::InjaError& e) {
+            throw TemplateError("Template rendering error: " + std::string(e.what()));
+        }
+    }
+
+    // The stream rethrows what the buffer throws, so a sink that stops the
+    // render ends it at once instead of letting it run on into a failed stream.
+    bool renderStream(const std::filesystem::path& templatePath, const nlohmann::json& data,
+                      const OutputSink& sink, size_t bufferSize) const {
+        auto compiled = compiledTemplate(templatePath);
+        SinkBuffer buffer(sink, bufferSize);
+        std::ostream output(&buffer);
+        output.exceptions(std::ios::badbit);
+        try {
+            compiled->environment->render_to(output, compiled->root, data);
+            buffer.flush();
+        } catch (const StreamStopped&) {
+            return false;
+        } catch (const inja::InjaError& e) {
+            throw TemplateError("Template rendering error: " + std::string(e.what()));
+        }
+        return true;
+    }
+
+    void renderInto(const std::filesystem::path& templatePath, const nlohmann::json& data, std::string& buffer) const {
+        renderInto(*compiledTemplate(templatePath), data, buffer);
+    }
+
+    // Appends to buffer through a stream buffer that writes into it directly;
+    // on failure the buffer is cut back to its original length.
+    static void renderInto(const CompiledTemplate& compiled, const nlohmann::json& data, std::string& buffer) {
+        size_t originalSize = buffer.size();
+        StringAppendBuffer appender(buffer);
+        std::ostream output(&appender);
+        try {
+            compiled.environment->render_to(output, compiled.root, data);
         } catch (const inja::InjaError& e) {
+            buffer.resize(originalSize);
             throw TemplateError("Template rendering error: " + std::string(e.what()));
         }
     }
 
+    static nlohmann::json toJson(const DataMap& data) {
+        return convertMap(data);
+    }
+
+    void reloadTemplate(const std::filesystem::path& templatePath) {
+        cache_.invalidate(templatePath);
+    }
+
+    void reloadTemplates() {
+        cache_.clear();
+    }
+
 private:
-    inja::Environment env_;
+    static constexpr size_t MAX_SCRATCH_CAPACITY = 4 * 1024 * 1024;
+
+    enum class Outcome { Failed, Written, Unchanged, Skipped };
+
+    // With a manifest, an output whose data and template files match its last
+    // render is skipped, and one that renders to the same bytes is not
+    // rewritten; either way a missing gzip copy is still produced. The gzip
+    // copy is written first, so it is already in place by the time the new
+    // output becomes visible. Each thread keeps its render buffer between
+    // calls, unless a huge page made it too big to be worth holding on to.
+    Outcome writeOutput(const CompiledTemplate& compiled, const nlohmann::json& data,
+                        const std::filesystem::path& outputPath) const {
+        auto gzipPath = outputPath;
+        gzipPath += ".gz";
+
+        std::string outputKey;
+        OutputRecord entry;
+        std::optional<OutputRecord> previous;
+        bool outputExists = false;
+        if (manifest_) {
+            outputKey = outputPath.lexically_normal().string();
+            entry.dataHash = BuildManifest::hashData(data);
+            entry.dependencyHash = compiled.dependencyHash;
+            previous = manifest_->find(outputKey);
+            outputExists = previous && std::filesystem::exists(outputPath);
+            if (outputExists && previous->dataHash == entry.dataHash &&
+                previous->dependencyHash == entry.dependencyHash &&
+                (!outputOptions_.gzip || std::filesystem::exists(gzipPath))) {
+                return Outcome::Skipped;
+            }
+        }
+
+        thread_local std::string scratch;
+        scratch.clear();
+        renderInto(compiled, data, scratch);
+
+        Outcome outcome = Outcome::Written;
+        if (manifest_) {
+            entry.contentHash = BuildManifest::hashBytes(scratch);
+            if (outputExists && previous->contentHash == entry.contentHash) {
+                outcome = Outcome::Unchanged;
+            }
+        }
+
+        if (outputOptions_.gzip && (outcome == Outcome::Written || !std::filesystem::exists(gzipPath))) {
+            thread_local std::string compressed;
+            if (!compress_body(ContentEncoding::Gzip, scratch, outputOptions_.gzipLevel, compressed)) {
+                throw TemplateError("Failed to compress output file: " + outputPath.string());
+            }
+            writeFileAtomically(gzipPath, compressed, outputOptions_.sync);
+            if (compressed.capacity() > MAX_SCRATCH_CAPACITY) {
+                std::string().swap(compressed);
+            }
+        }
+        if (outcome == Outcome::Written) {
+            writeFileAtomically(outputPath, scratch, outputOptions_.sync);
+        }
+        if (manifest_) {
+            manifest_->record(outputKey, entry);
+        }
+
+        if (scratch.capacity() > MAX_SCRATCH_CAPACITY) {
+            std::string().swap(scratch);
+        }
+        return outcome;
+    }
+
+    std::shared_ptr<const CompiledTemplate> compiledTemplate(const std::filesystem::path& templatePath) const {
+        try {
+            return cache_.get(templatePath);
+        } catch (const inja::InjaError& e) {
+            throw TemplateError("Template rendering error: " + std::string(e.what()));
+        }
+    }
+
+    TemplateCache& cache_;
+    std::unique_ptr<BuildManifest> manifest_;
+    OutputOptions outputOptions_;
 };
 
 TemplateRenderer::TemplateRenderer() : impl_(std::make_unique<TemplateRendererImpl>()) {}
@@ -94,8 +483,117 @@ TemplateRenderer& TemplateRenderer::operator=(TemplateRenderer&&) noexcept = def
 void TemplateRenderer::renderTemplate(const std::filesystem::path& templatePath,
                                     const std::filesystem::path& outputDir,
                                     const std::string& outputFilename,
-                                    const DataMap& data) {
-    impl_->renderTemplate(templatePath, outputDir, outputFilename, data);
+                                    const DataMap& data) const {
+    impl_->renderTemplate(templatePath, outputDir, outputFilename, TemplateRendererImpl::toJson(data));
+}
+
+void TemplateRenderer::renderTemplate(const std::filesystem::path& templatePath,
+                                    const std::filesystem::path& outputDir,
+                                    const std::string& outputFilename,
+                                    const Context& context) const {
+    impl_->renderTemplate(templatePath, outputDir, outputFilename, context.impl_->data);
+}
+
+std::string TemplateRenderer::renderToString(const std::filesystem::path& templatePath, const DataMap& data) const {
+    std::string result;
+    impl_->renderInto(templatePath, TemplateRendererImpl::toJson(data), result);
+    return result;
+}
+
+std::string TemplateRenderer::renderToString(const std::filesystem::path& templatePath, const Context& context) const {
+    std::string result;
+    impl_->renderInto(templatePath, context.impl_->data, result);
+    return result;
+}
+
+void TemplateRenderer::renderTo(const std::filesystem::path& templatePath, const DataMap& data, std::ostream& output) const {
+    impl_->renderTo(templatePath, TemplateRendererImpl::toJson(data), output);
+}
+
+void TemplateRenderer::renderTo(const std::filesystem::path& templatePath, const Context& context, std::ostream& output) const {
+    impl_->renderTo(templatePath, context.impl_->data, output);
+}
+
+void TemplateRenderer::renderInto(const std::filesystem::path& templatePath, const DataMap& data, std::string& buffer) const {
+    impl_->renderInto(templatePath, TemplateRendererImpl::toJson(data), buffer);
+}
+
+void TemplateRenderer::renderInto(const std::filesystem::path& templatePath, const Context& context, std::string& buffer) const {
+    impl_->renderInto(templatePath, context.impl_->data, buffer);
+}
+
+bool TemplateRenderer::renderStream(const std::filesystem::path& templatePath, const DataMap& data,
+                                    const OutputSink& sink, size_t bufferSize) const {
+    return impl_->renderStream(templatePath, TemplateRendererImpl::toJson(data), sink, bufferSize);
+}
+
+bool TemplateRenderer::renderStream(const std::filesystem::path& templatePath, const Context& context,
+                                    const OutputSink& sink, size_t bufferSize) const {
+    return impl_->renderStream(templatePath, context.impl_->data, sink, bufferSize);
+}
+
+TemplateRenderer::BatchResult TemplateRenderer::renderBatch(const std::vector<RenderJob>& jobs,
+                                                            const std::filesystem::path& outputDir,
+                                                            size_t threadCount) const {
+    std::vector<const nlohmann::json*> data;
+    data.reserve(jobs.size());
+    for (const auto& job : jobs) {
+        data.push_back(&job.context.impl_->data);
+    }
+    return impl_->renderBatch(jobs, data, outputDir, threadCount);
+}
+
+void TemplateRenderer::useManifest(const std::filesystem::path& manifestPath) {
+    impl_->useManifest(manifestPath);
+}
+
+void TemplateRenderer::saveManifest() const {
+    impl_->saveManifest();
+}
+
+void TemplateRenderer::setOutputOptions(const OutputOptions& options) {
+    impl_->setOutputOptions(options);
+}
+
+void TemplateRenderer::reloadTemplate(const std::filesystem::path& templatePath) {
+    impl_->reloadTemplate(templatePath);
+}
+
+void TemplateRenderer::reloadTemplates() {
+    impl_->reloadTemplates();
+}
+
+void TemplateRenderer::setRevalidationInterval(std::chrono::milliseconds interval) {
+    TemplateCache::shared().setRevalidationInterval(interval);
+}
+
+void TemplateRenderer::registerTemplate(const std::string& name, const std::string& source) {
+    try {
+        TemplateCache::shared().registerSource(name, source);
+    } catch (const inja::InjaError& e) {
+        throw TemplateError("Template rendering error: " + std::string(e.what()));
+    }
+}
+
+void TemplateRenderer::registerTemplates(const std::map<std::string, std::string>& templates) {
+    try {
+        TemplateCache::shared().registerSources(templates);
+    } catch (const inja::InjaError& e) {
+        throw TemplateError("Template rendering error: " + std::string(e.what()));
+    }
+}
+
+void TemplateRenderer::unregisterTemplate(const std::string& name) {
+    TemplateCache::shared().unregisterSource(name);
+}
+
+size_t TemplateRenderer::preloadDirectory(const std::filesystem::path& directory,
+                                          const std::vector<std::string>& extensions) {
+    try {
+        return TemplateCache::shared().preload(directory, extensions);
+    } catch (const inja::InjaError& e) {
+        throw TemplateError("Template rendering error: " + std::string(e.what()));
+    }
 }
 
 } // namespace cppwebforge
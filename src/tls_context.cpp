@@ -0,0 +1,172 @@
+#include "tls_context.h"
+#include "file_util.h"
+#include "logger.h"
+#include <chrono>
+#include <filesystem>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <stdexcept>
+
+namespace cppwebforge {
+
+namespace {
+constexpr unsigned char SESSION_ID_CONTEXT[] = "cppwebforge";
+constexpr unsigned char ALPN_PROTOCOLS[] = {8, 'h', 't', 't', 'p', '/', '1', '.', '1'};
+
+using BioPtr = std::unique_ptr<BIO, decltype(&BIO_free)>;
+
+BioPtr open_file(const std::string& path) {
+    BioPtr bio(BIO_new_file(path.c_str(), "r"), BIO_free);
+    if (!bio) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    return bio;
+}
+
+int64_t now_seconds() {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+}
+
+struct TlsContext::Certificates {
+    X509* cert = nullptr;
+    EVP_PKEY* key = nullptr;
+    STACK_OF(X509)* chain = nullptr;
+    std::filesystem::file_time_type cert_modified;
+    std::filesystem::file_time_type key_modified;
+
+    Certificates() = default;
+    Certificates(const Certificates&) = delete;
+    Certificates& operator=(const Certificates&) = delete;
+
+    ~Certificates() {
+        X509_free(cert);
+        EVP_PKEY_free(key);
+        sk_X509_pop_free(chain, X509_free);
+    }
+};
+
+TlsContext::TlsContext(const TlsOptions& options) : options_(options), certificates_(load(options)) {}
+
+TlsContext::~TlsContext() = default;
+
+bool TlsContext::configure(SSL_CTX& ctx) {
+    auto certificates = current();
+    SSL_CTX_set_min_proto_version(&ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(&ctx, SSL_OP_NO_COMPRESSION | SSL_OP_NO_RENEGOTIATION);
+    if (SSL_CTX_use_certificate(&ctx, certificates->cert) != 1 || SSL_CTX_use_PrivateKey(&ctx, certificates->key) != 1) {
+        return false;
+    }
+    SSL_CTX_set_cert_cb(&ctx, select_certificate, this);
+
+    SSL_CTX_set_session_id_context(&ctx, SESSION_ID_CONTEXT, sizeof(SESSION_ID_CONTEXT) - 1);
+    if (options_.session_cache_size > 0) {
+        SSL_CTX_set_session_cache_mode(&ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(&ctx, static_cast<long>(options_.session_cache_size));
+    } else {
+        SSL_CTX_set_session_cache_mode(&ctx, SSL_SESS_CACHE_OFF);
+    }
+    SSL_CTX_set_timeout(&ctx, static_cast<long>(options_.session_timeout.count()));
+    if (!options_.session_tickets) {
+        SSL_CTX_set_options(&ctx, SSL_OP_NO_TICKET);
+    }
+    SSL_CTX_set_alpn_select_cb(&ctx, select_protocol, nullptr);
+
+    if (!options_.client_ca_path.empty()) {
+        if (SSL_CTX_load_verify_locations(&ctx, options_.client_ca_path.c_str(), nullptr) != 1) {
+            return false;
+        }
+        SSL_CTX_set_verify(&ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, nullptr);
+    }
+    return true;
+}
+
+void TlsContext::reload() {
+    auto certificates = load(options_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    certificates_ = std::move(certificates);
+}
+
+std::shared_ptr<const TlsContext::Certificates> TlsContext::load(const TlsOptions& options) {
+    auto certificates = std::make_shared<Certificates>();
+    certificates->cert_modified = modified_time(options.cert_path);
+    certificates->key_modified = modified_time(options.key_path);
+
+    BioPtr cert_file = open_file(options.cert_path);
+    certificates->cert = PEM_read_bio_X509_AUX(cert_file.get(), nullptr, nullptr, nullptr);
+    if (certificates->cert == nullptr) {
+        throw std::runtime_error("Failed to read certificate from " + options.cert_path);
+    }
+    certificates->chain = sk_X509_new_null();
+    while (X509* intermediate = PEM_read_bio_X509(cert_file.get(), nullptr, nullptr, nullptr)) {
+        sk_X509_push(certificates->chain, intermediate);
+    }
+    ERR_clear_error();
+
+    BioPtr key_file = open_file(options.key_path);
+    certificates->key = PEM_read_bio_PrivateKey(key_file.get(), nullptr, nullptr, nullptr);
+    if (certificates->key == nullptr) {
+        throw std::runtime_error("Failed to read private key from " + options.key_path);
+    }
+    if (X509_check_private_key(certificates->cert, certificates->key) != 1) {
+        ERR_clear_error();
+        throw std::runtime_error("Private key " + options.key_path + " does not match " + options.cert_path);
+    }
+    return certificates;
+}
+
+int TlsContext::select_certificate(SSL* ssl, void* arg) {
+    auto* context = static_cast<TlsContext*>(arg);
+    context->reload_if_changed();
+    auto certificates = context->current();
+    if (SSL_use_certificate(ssl, certificates->cert) != 1 || SSL_use_PrivateKey(ssl, certificates->key) != 1 ||
+        SSL_set1_chain(ssl, certificates->chain) != 1) {
+        return 0;
+    }
+    return 1;
+}
+
+int TlsContext::select_protocol(SSL* /*ssl*/, const unsigned char** out, unsigned char* out_length,
+                                const unsigned char* in, unsigned int in_length, void* /*arg*/) {
+    unsigned char* selected = nullptr;
+    if (SSL_select_next_proto(&selected, out_length, ALPN_PROTOCOLS, sizeof(ALPN_PROTOCOLS), in, in_length) !=
+        OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+std::shared_ptr<const TlsContext::Certificates> TlsContext::current() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return certificates_;
+}
+
+// Runs from handshakes; one caller per interval stats the files and reloads them
+// when they changed. A half-written or mismatched pair keeps the old certificate.
+void TlsContext::reload_if_changed() {
+    if (options_.reload_interval.count() <= 0) {
+        return;
+    }
+    int64_t now = now_seconds();
+    int64_t next = next_check_.load(std::memory_order_relaxed);
+    if (now < next || !next_check_.compare_exchange_strong(next, now + options_.reload_interval.count())) {
+        return;
+    }
+
+    auto certificates = current();
+    if (modified_time(options_.cert_path) == certificates->cert_modified &&
+        modified_time(options_.key_path) == certificates->key_modified) {
+        return;
+    }
+    try {
+        reload();
+        FORGE_INFO("Reloaded TLS certificate from {}", options_.cert_path);
+    } catch (const std::runtime_error& error) {
+        FORGE_INFO("Failed to reload TLS certificate from {}, keeping the previous one: {}", options_.cert_path,
+                   error.what());
+    }
+}
+
+} // namespace cppwebforge
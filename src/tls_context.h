@@ -0,0 +1,44 @@
+#pragma once
+
+#include "http_server.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <openssl/ssl.h>
+
+namespace cppwebforge {
+
+// Owns the server certificate and configures the SSL_CTX that httplib creates.
+// The certificate is applied per handshake from the current bundle, so a reload
+// swaps it without touching the context and keeps the session cache and the
+// ticket keys, letting clients resume across certificate rotations.
+class TlsContext {
+public:
+    explicit TlsContext(const TlsOptions& options);
+    ~TlsContext();
+
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    bool configure(SSL_CTX& ctx);
+    void reload();
+
+private:
+    struct Certificates;
+
+    static std::shared_ptr<const Certificates> load(const TlsOptions& options);
+    static int select_certificate(SSL* ssl, void* arg);
+    static int select_protocol(SSL* ssl, const unsigned char** out, unsigned char* out_length,
+                               const unsigned char* in, unsigned int in_length, void* arg);
+
+    std::shared_ptr<const Certificates> current() const;
+    void reload_if_changed();
+
+    const TlsOptions options_;
+    mutable std::mutex mutex_;
+    std::shared_ptr<const Certificates> certificates_;
+    std::atomic<int64_t> next_check_{0};
+};
+
+} // namespace cppwebforge
@@ -1,8 +1,15 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 #include <thread>
+#include <atomic>
 #include <chrono>
+#include <future>
+#include <mutex>
+#include <vector>
+#include <cstdio>
 #include <curl/curl.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
 #include "../include/http_server.h"
 
 namespace {
@@ -12,6 +19,106 @@ size_t WriteCallback(void* contents, size_t size, size_t nmemb, std::string* use
     return size * nmemb;
 }
 
+struct RawResponse {
+    long status = 0;
+    std::string headers;
+    std::string body;
+};
+
+RawResponse perform_raw_request(const std::string& url,
+                                const std::vector<std::string>& request_headers = {},
+                                const std::string& accept_encoding = "") {
+    RawResponse response;
+    CURL* curl = curl_easy_init();
+    if (!curl) throw std::runtime_error("Failed to initialize CURL");
+
+    struct curl_slist* headers = nullptr;
+    for (const auto& header : request_headers) {
+        headers = curl_slist_append(headers, header.c_str());
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response.body);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, WriteCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response.headers);
+    if (!accept_encoding.empty()) {
+        curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, accept_encoding.c_str());
+    }
+    if (url.rfind("https://", 0) == 0) {
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    }
+
+    CURLcode res = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.status);
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+
+    if (res != CURLE_OK) {
+        throw std::runtime_error(curl_easy_strerror(res));
+    }
+    return response;
+}
+
+std::string peer_certificate_subject(const std::string& url) {
+    CURL* curl = curl_easy_init();
+    if (!curl) throw std::runtime_error("Failed to initialize CURL");
+
+    std::string body;
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    curl_easy_setopt(curl, CURLOPT_CERTINFO, 1L);
+
+    std::string subject;
+    if (curl_easy_perform(curl) == CURLE_OK) {
+        struct curl_certinfo* certinfo = nullptr;
+        curl_easy_getinfo(curl, CURLINFO_CERTINFO, &certinfo);
+        if (certinfo != nullptr && certinfo->num_of_certs > 0) {
+            for (struct curl_slist* field = certinfo->certinfo[0]; field != nullptr; field = field->next) {
+                if (std::string(field->data).rfind("Subject:", 0) == 0) {
+                    subject = field->data;
+                }
+            }
+        }
+    }
+    curl_easy_cleanup(curl);
+    return subject;
+}
+
+void write_self_signed_certificate(const std::string& cert_path, const std::string& key_path, const char* common_name) {
+    EVP_PKEY* key = EVP_RSA_gen(2048);
+    X509* cert = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>(common_name), -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509_sign(cert, key, EVP_sha256());
+
+    FILE* cert_file = std::fopen(cert_path.c_str(), "w");
+    PEM_write_X509(cert_file, cert);
+    std::fclose(cert_file);
+    FILE* key_file = std::fopen(key_path.c_str(), "w");
+    PEM_write_PrivateKey(key_file, key, nullptr, nullptr, 0, nullptr, nullptr);
+    std::fclose(key_file);
+
+    X509_free(cert);
+    EVP_PKEY_free(key);
+}
+
+// Collects a text/event-stream body until the "done" event arrives.
+size_t CollectEvents(char* contents, size_t size, size_t nmemb, std::string* events) {
+    events->append(contents, size * nmemb);
+    return events->find("event: done") == std::string::npos ? size * nmemb : 0;
+}
+
 class CURLWrapper {
 public:
     CURLWrapper() {
@@ -248,4 +355,844 @@ TEST_F(HTTPServerTest, MultipleEndpoints) {
     stop_server(server.get());
 }
 
+TEST_F(HTTPServerTest, GzipCompression) {
+    const std::string large_body(4096, 'a');
+    HTTPServer::Builder builder;
+    auto server = builder.port(8086)
+                        .address("127.0.0.1")
+                        .compression()
+                        .get("/large", [&large_body](const Request& req, Response& res) {
+                            res.set_content(large_body, "text/plain");
+                        })
+                        .get("/small", [](const Request& req, Response& res) {
+                            res.set_content("tiny", "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    auto compressed = perform_raw_request("http://127.0.0.1:8086/large", {}, "gzip");
+    EXPECT_EQ(compressed.status, 200);
+    EXPECT_EQ(compressed.body, large_body);
+    EXPECT_NE(compressed.headers.find("Content-Encoding: gzip"), std::string::npos);
+    
+    auto identity = perform_raw_request("http://127.0.0.1:8086/large");
+    EXPECT_EQ(identity.body, large_body);
+    EXPECT_EQ(identity.headers.find("Content-Encoding"), std::string::npos);
+    
+    auto small = perform_raw_request("http://127.0.0.1:8086/small", {}, "gzip");
+    EXPECT_EQ(small.body, "tiny");
+    EXPECT_EQ(small.headers.find("Content-Encoding"), std::string::npos);
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, CompressionFollowsAcceptEncodingRules) {
+    const std::string large_body(4096, 'a');
+    HTTPServer::Builder builder;
+    auto server = builder.port(8107)
+                        .address("127.0.0.1")
+                        .compression()
+                        .get("/large", [&large_body](const Request& req, Response& res) {
+                            res.set_header("ETag", "\"v1\"");
+                            res.set_content(large_body, "text/plain");
+                        })
+                        .get("/small", [](const Request& req, Response& res) {
+                            res.set_content("tiny", "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    auto wildcard = perform_raw_request("http://127.0.0.1:8107/large", {}, "*");
+    EXPECT_EQ(wildcard.status, 200);
+    EXPECT_NE(wildcard.headers.find("Content-Encoding: "), std::string::npos);
+    EXPECT_NE(wildcard.headers.find("ETag: W/\"v1\""), std::string::npos);
+    
+    auto prefers_identity = perform_raw_request("http://127.0.0.1:8107/large", {}, "gzip;q=0.5, identity");
+    EXPECT_EQ(prefers_identity.body, large_body);
+    EXPECT_EQ(prefers_identity.headers.find("Content-Encoding"), std::string::npos);
+    EXPECT_NE(prefers_identity.headers.find("ETag: \"v1\""), std::string::npos);
+    
+    auto excluded = perform_raw_request("http://127.0.0.1:8107/large", {}, "*;q=0, gzip");
+    EXPECT_NE(excluded.headers.find("Content-Encoding: gzip"), std::string::npos);
+    
+    auto no_identity = perform_raw_request("http://127.0.0.1:8107/small", {}, "gzip, identity;q=0");
+    EXPECT_EQ(no_identity.body, "tiny");
+    EXPECT_NE(no_identity.headers.find("Content-Encoding: gzip"), std::string::npos);
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, GzipCompressionExtendsHandlerVary) {
+    const std::string large_body(4096, 'a');
+    HTTPServer::Builder builder;
+    auto server = builder.port(8103)
+                        .address("127.0.0.1")
+                        .compression()
+                        .get("/origin", [&large_body](const Request& req, Response& res) {
+                            res.set_header("Vary", "Origin");
+                            res.set_content(large_body, "text/plain");
+                        })
+                        .get("/listed", [&large_body](const Request& req, Response& res) {
+                            res.set_header("Vary", "origin, accept-encoding");
+                            res.set_content(large_body, "text/plain");
+                        })
+                        .build();
+
+    start_server(server.get());
+
+    auto origin = perform_raw_request("http://127.0.0.1:8103/origin", {}, "gzip");
+    EXPECT_EQ(origin.body, large_body);
+    EXPECT_NE(origin.headers.find("Vary: Origin, Accept-Encoding\r\n"), std::string::npos);
+    EXPECT_EQ(origin.headers.find("Vary:"), origin.headers.rfind("Vary:"));
+
+    auto listed = perform_raw_request("http://127.0.0.1:8103/listed", {}, "gzip");
+    EXPECT_NE(listed.headers.find("Vary: origin, accept-encoding\r\n"), std::string::npos);
+    EXPECT_EQ(listed.headers.find("Vary:"), listed.headers.rfind("Vary:"));
+
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, ChunkedStreamingResponse) {
+    HTTPServer::Builder builder;
+    auto server = builder.port(8087)
+                        .address("127.0.0.1")
+                        .get("/export", [](const Request& req, Response& res) {
+                            res.set_chunked_content("text/csv", [](ResponseWriter& writer) {
+                                for (int row = 0; row < 1000; ++row) {
+                                    if (!writer.write("row," + std::to_string(row) + "\n")) {
+                                        return;
+                                    }
+                                }
+                                writer.flush();
+                                writer.write("end\n");
+                            });
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    std::string expected;
+    for (int row = 0; row < 1000; ++row) {
+        expected += "row," + std::to_string(row) + "\n";
+    }
+    expected += "end\n";
+    
+    auto response = perform_raw_request("http://127.0.0.1:8087/export");
+    EXPECT_EQ(response.status, 200);
+    EXPECT_EQ(response.body, expected);
+    EXPECT_NE(response.headers.find("Transfer-Encoding: chunked"), std::string::npos);
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, SharedAndBorrowedContent) {
+    static const std::string static_page = "<html>static</html>";
+    auto shared_page = std::make_shared<const std::string>(8192, 'x');
+    
+    HTTPServer::Builder builder;
+    auto server = builder.port(8088)
+                        .address("127.0.0.1")
+                        .get("/shared", [shared_page](const Request& req, Response& res) {
+                            res.set_content(shared_page, "text/plain");
+                        })
+                        .get("/view", [](const Request& req, Response& res) {
+                            res.set_content_view(static_page, "text/html");
+                        })
+                        .get("/moved", [](const Request& req, Response& res) {
+                            std::string body = "moved body";
+                            res.set_content(std::move(body), "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    for (int i = 0; i < 2; ++i) {
+        auto shared = perform_raw_request("http://127.0.0.1:8088/shared");
+        EXPECT_EQ(shared.status, 200);
+        EXPECT_EQ(shared.body, *shared_page);
+    }
+    
+    auto view = perform_raw_request("http://127.0.0.1:8088/view");
+    EXPECT_EQ(view.body, static_page);
+    EXPECT_NE(view.headers.find("Content-Type: text/html"), std::string::npos);
+    
+    auto moved = perform_raw_request("http://127.0.0.1:8088/moved");
+    EXPECT_EQ(moved.body, "moved body");
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, MiddlewarePipeline) {
+    std::vector<std::string> calls;
+    std::mutex calls_mutex;
+    auto record = [&calls, &calls_mutex](const std::string& call) {
+        std::lock_guard<std::mutex> lock(calls_mutex);
+        calls.push_back(call);
+    };
+    
+    HTTPServer::Builder builder;
+    auto server = builder.port(8089)
+                        .address("127.0.0.1")
+                        .after([record](const Request& req, Response& res) {
+                            record("after");
+                            res.set_header("X-After", "1");
+                        })
+                        .around([record](const Request& req, Response& res, const Next& next) {
+                            record("around-in");
+                            next();
+                            record("around-out");
+                        })
+                        .before([record](const Request& req, Response& res) {
+                            record("before");
+                            if (!req.has_header("Authorization")) {
+                                res.set_status(401);
+                                res.set_content("unauthorized", "text/plain");
+                                return false;
+                            }
+                            return true;
+                        })
+                        .get("/secure", [record](const Request& req, Response& res) {
+                            record("handler");
+                            res.set_content("secret", "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    auto allowed = perform_raw_request("http://127.0.0.1:8089/secure", {"Authorization: Bearer token"});
+    EXPECT_EQ(allowed.status, 200);
+    EXPECT_EQ(allowed.body, "secret");
+    EXPECT_NE(allowed.headers.find("X-After: 1"), std::string::npos);
+    EXPECT_EQ(calls, (std::vector<std::string>{"around-in", "before", "handler", "around-out", "after"}));
+    
+    calls.clear();
+    auto rejected = perform_raw_request("http://127.0.0.1:8089/secure");
+    EXPECT_EQ(rejected.status, 401);
+    EXPECT_EQ(rejected.body, "unauthorized");
+    EXPECT_EQ(calls, (std::vector<std::string>{"around-in", "before", "around-out", "after"}));
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, ResponseCacheSkipsChunkedResponses) {
+    std::atomic<int> renders{0};
+    CacheOptions cache_options;
+    cache_options.ttl = std::chrono::seconds(60);
+    
+    HTTPServer::Builder builder;
+    auto server = builder.port(8101)
+                        .address("127.0.0.1")
+                        .cache("/export", cache_options)
+                        .get("/export", [&renders](const Request& req, Response& res) {
+                            int render = ++renders;
+                            res.set_chunked_content("text/plain", [render](ResponseWriter& writer) {
+                                writer.write("export " + std::to_string(render));
+                            });
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    auto first = perform_raw_request("http://127.0.0.1:8101/export");
+    auto second = perform_raw_request("http://127.0.0.1:8101/export");
+    EXPECT_EQ(first.status, 200);
+    EXPECT_EQ(first.body, "export 1");
+    EXPECT_EQ(second.status, 200);
+    EXPECT_EQ(second.body, "export 2");
+    EXPECT_EQ(renders.load(), 2);
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, ResponseCache) {
+    std::atomic<int> renders{0};
+    CacheOptions cache_options;
+    cache_options.ttl = std::chrono::seconds(60);
+    
+    HTTPServer::Builder builder;
+    auto server = builder.port(8090)
+                        .address("127.0.0.1")
+                        .cache("/report", cache_options)
+                        .get("/report", [&renders](const Request& req, Response& res) {
+                            int render = ++renders;
+                            res.set_content("render " + std::to_string(render), "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    auto first = perform_raw_request("http://127.0.0.1:8090/report");
+    auto second = perform_raw_request("http://127.0.0.1:8090/report");
+    EXPECT_EQ(first.status, 200);
+    EXPECT_EQ(first.body, "render 1");
+    EXPECT_EQ(second.body, "render 1");
+    EXPECT_NE(second.headers.find("ETag: "), std::string::npos);
+    EXPECT_EQ(renders.load(), 1);
+    
+    auto other_query = perform_raw_request("http://127.0.0.1:8090/report?page=2");
+    EXPECT_EQ(other_query.body, "render 2");
+    EXPECT_EQ(renders.load(), 2);
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, ConnectionSettings) {
+    HTTPServer::Builder builder;
+    auto server = builder.port(8091)
+                        .address("127.0.0.1")
+                        .keep_alive_max_count(100)
+                        .keep_alive_timeout(std::chrono::seconds(10))
+                        .read_timeout(std::chrono::seconds(2))
+                        .write_timeout(std::chrono::seconds(2))
+                        .payload_max_length(16)
+                        .worker_threads(4)
+                        .max_connections(64)
+                        .max_connections_per_ip(8)
+                        .metrics()
+                        .post("/upload", [](const Request& req, Response& res) {
+                            res.set_content("accepted", "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    CURLWrapper curl;
+    auto [small_status, small_response] = curl.perform_request("http://127.0.0.1:8091/upload", "POST", "tiny");
+    EXPECT_EQ(small_status, 200);
+    EXPECT_EQ(small_response, "accepted");
+    
+    auto [large_status, large_response] = curl.perform_request("http://127.0.0.1:8091/upload", "POST", std::string(1024, 'x'));
+    EXPECT_EQ(large_status, 413);
+    
+    auto metrics = perform_raw_request("http://127.0.0.1:8091/metrics");
+    EXPECT_NE(metrics.body.find("cppwebforge_requests_total{method=\"POST\",route=\"/upload\",status=\"4xx\"} 1"),
+              std::string::npos);
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, GracefulShutdownDrainsInFlightRequests) {
+    HTTPServer::Builder builder;
+    auto server = builder.port(8092)
+                        .address("127.0.0.1")
+                        .reuse_port()
+                        .get("/slow", [](const Request& req, Response& res) {
+                            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+                            res.set_content("finished", "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    RawResponse response;
+    std::thread client([&response]() {
+        response = perform_raw_request("http://127.0.0.1:8092/slow");
+    });
+    
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_TRUE(server->shutdown(std::chrono::seconds(5)));
+    client.join();
+    
+    EXPECT_EQ(response.status, 200);
+    EXPECT_EQ(response.body, "finished");
+    EXPECT_NE(response.headers.find("Connection: close"), std::string::npos);
+
+    stop_server(server.get());
+
+    start_server(server.get());
+    auto restarted = perform_raw_request("http://127.0.0.1:8092/slow");
+    EXPECT_EQ(restarted.status, 200);
+    EXPECT_EQ(restarted.headers.find("Connection: close"), std::string::npos);
+
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, PrometheusMetrics) {
+    HTTPServer::Builder builder;
+    auto server = builder.port(8093)
+                        .address("127.0.0.1")
+                        .metrics()
+                        .get("/hello", [](const Request& req, Response& res) {
+                            res.set_content("hello", "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    perform_raw_request("http://127.0.0.1:8093/hello");
+    perform_raw_request("http://127.0.0.1:8093/hello");
+    
+    auto metrics = perform_raw_request("http://127.0.0.1:8093/metrics");
+    EXPECT_EQ(metrics.status, 200);
+    EXPECT_NE(metrics.body.find("cppwebforge_requests_total{method=\"GET\",route=\"/hello\",status=\"2xx\"} 2"),
+              std::string::npos);
+    EXPECT_NE(metrics.body.find("cppwebforge_request_duration_seconds_count{method=\"GET\",route=\"/hello\"} 2"),
+              std::string::npos);
+    EXPECT_NE(metrics.body.find("cppwebforge_response_bytes_total{method=\"GET\",route=\"/hello\"} 10"),
+              std::string::npos);
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, StreamingUploadWithBodyLimit) {
+    HTTPServer::Builder builder;
+    auto server = builder.port(8094)
+                        .address("127.0.0.1")
+                        .max_body_size("/upload", 1024)
+                        .max_body_size("/buffered", 1024)
+                        .post("/upload", [](const Request& req, Response& res, BodyReader& body) {
+                            size_t chunks = 0;
+                            bool complete = body.read([&chunks](std::string_view chunk) {
+                                ++chunks;
+                                return true;
+                            });
+                            if (complete) {
+                                res.set_content(std::to_string(body.bytes_read()), "text/plain");
+                            }
+                        })
+                        .post("/buffered", [](const Request& req, Response& res) {
+                            res.set_content(req.body(), "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    CURLWrapper curl;
+    auto [accepted_status, accepted_body] = curl.perform_request("http://127.0.0.1:8094/upload", "POST", std::string(512, 'u'));
+    EXPECT_EQ(accepted_status, 200);
+    EXPECT_EQ(accepted_body, "512");
+    
+    CURLWrapper oversized_curl;
+    auto [rejected_status, rejected_body] = oversized_curl.perform_request("http://127.0.0.1:8094/upload", "POST", std::string(4096, 'u'));
+    EXPECT_EQ(rejected_status, 413);
+    
+    CURLWrapper buffered_curl;
+    auto [buffered_status, buffered_body] = buffered_curl.perform_request("http://127.0.0.1:8094/buffered", "POST", "buffered body");
+    EXPECT_EQ(buffered_status, 200);
+    EXPECT_EQ(buffered_body, "buffered body");
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, RequestAccessors) {
+    HTTPServer::Builder builder;
+    auto server = builder.port(8095)
+                        .address("127.0.0.1")
+                        .get("/users/:id", [](const Request& req, Response& res) {
+                            std::string result(req.path_param("id").value_or("none"));
+                            result += "|" + std::string(req.query("sort").value_or("none"));
+                            result += "|" + std::string(req.header("x-trace-id").value_or("none"));
+                            result += "|" + std::string(req.cookie("session").value_or("none"));
+                            result += "|" + std::string(req.cookie("missing").value_or("none"));
+                            size_t header_count = 0;
+                            req.for_each_header([&header_count](std::string_view, std::string_view) {
+                                ++header_count;
+                            });
+                            result += header_count > 0 ? "|headers" : "|empty";
+                            res.set_content(result, "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    auto response = perform_raw_request("http://127.0.0.1:8095/users/42?sort=asc",
+                                        {"X-Trace-Id: abc123", "Cookie: theme=dark; session=s3cr3t"});
+    EXPECT_EQ(response.status, 200);
+    EXPECT_EQ(response.body, "42|asc|abc123|s3cr3t|none|headers");
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, AsyncHandlerReleasesWorker) {
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::promise<void> started;
+    
+    HTTPServer::Builder builder;
+    auto server = builder.port(8096)
+                        .address("127.0.0.1")
+                        .worker_threads(1)
+                        .max_worker_threads(2)
+                        .get_async("/slow", [&started, released](const Request& req, Response& res, HTTPServer::Completion done) {
+                            started.set_value();
+                            std::thread([&res, released, done = std::move(done)] {
+                                released.wait();
+                                res.set_content("slow", "text/plain");
+                                done();
+                            }).detach();
+                        })
+                        .get("/fast", [](const Request& req, Response& res) {
+                            res.set_content("fast", "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    auto slow = std::async(std::launch::async, [] {
+        return perform_raw_request("http://127.0.0.1:8096/slow");
+    });
+    started.get_future().wait();
+    
+    auto fast = perform_raw_request("http://127.0.0.1:8096/fast");
+    EXPECT_EQ(fast.status, 200);
+    EXPECT_EQ(fast.body, "fast");
+    
+    release.set_value();
+    auto slow_response = slow.get();
+    EXPECT_EQ(slow_response.status, 200);
+    EXPECT_EQ(slow_response.body, "slow");
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, AsyncHandlerAbandonedAtDeadline) {
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::vector<std::thread> handlers;
+    std::mutex handlers_mutex;
+
+    AdmissionOptions admission;
+    admission.latency_target = std::chrono::seconds(10);
+
+    HTTPServer::Builder builder;
+    auto server = builder.port(8105)
+                        .address("127.0.0.1")
+                        .admission_control(admission)
+                        .get_async("/stuck", [&](const Request& req, Response& res, HTTPServer::Completion done) {
+                            std::lock_guard<std::mutex> lock(handlers_mutex);
+                            handlers.emplace_back([&res, released, done = std::move(done)] {
+                                released.wait();
+                                res.set_content("late", "text/plain");
+                                done();
+                            });
+                        })
+                        .build();
+
+    start_server(server.get());
+
+    auto started = std::chrono::steady_clock::now();
+    auto abandoned = perform_raw_request("http://127.0.0.1:8105/stuck", {"X-Request-Timeout-Ms: 200"});
+    EXPECT_EQ(abandoned.status, 503);
+    EXPECT_EQ(abandoned.body, "Deadline exceeded");
+    EXPECT_NE(abandoned.headers.find("Retry-After: 1"), std::string::npos);
+    EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(5));
+
+    auto stuck = std::async(std::launch::async, [] {
+        return perform_raw_request("http://127.0.0.1:8105/stuck");
+    });
+    for (int attempt = 0; attempt < 200; ++attempt) {
+        {
+            std::lock_guard<std::mutex> lock(handlers_mutex);
+            if (handlers.size() == 2) {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    server->shutdown(std::chrono::milliseconds(200));
+    EXPECT_EQ(stuck.get().status, 503);
+    stop_server(server.get());
+
+    release.set_value();
+    for (auto& handler : handlers) {
+        handler.join();
+    }
+}
+
+TEST_F(HTTPServerTest, AdmissionControlShedsByPriorityAndDeadline) {
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::promise<void> started;
+    
+    AdmissionOptions admission;
+    admission.initial_limit = 2;
+    admission.min_limit = 2;
+    admission.max_limit = 2;
+    admission.latency_target = std::chrono::seconds(10);
+    
+    HTTPServer::Builder builder;
+    auto server = builder.port(8097)
+                        .address("127.0.0.1")
+                        .admission_control(admission)
+                        .priority("/slow", RoutePriority::Critical)
+                        .priority("/health", RoutePriority::Critical)
+                        .get("/slow", [&started, released](const Request& req, Response& res) {
+                            started.set_value();
+                            released.wait();
+                            res.set_content("slow", "text/plain");
+                        })
+                        .get("/health", [](const Request& req, Response& res) {
+                            res.set_content("ok", "text/plain");
+                        })
+                        .get("/work", [](const Request& req, Response& res) {
+                            res.set_content(req.deadline() ? "deadline" : "none", "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    auto slow = std::async(std::launch::async, [] {
+        return perform_raw_request("http://127.0.0.1:8097/slow");
+    });
+    started.get_future().wait();
+    
+    auto shed = perform_raw_request("http://127.0.0.1:8097/work");
+    EXPECT_EQ(shed.status, 503);
+    EXPECT_NE(shed.headers.find("Retry-After: 1"), std::string::npos);
+    
+    auto critical = perform_raw_request("http://127.0.0.1:8097/health");
+    EXPECT_EQ(critical.status, 200);
+    
+    release.set_value();
+    EXPECT_EQ(slow.get().status, 200);
+    
+    auto expired = perform_raw_request("http://127.0.0.1:8097/work", {"X-Request-Timeout-Ms: 0"});
+    EXPECT_EQ(expired.status, 503);
+    EXPECT_EQ(expired.body, "Deadline exceeded");
+    EXPECT_NE(expired.headers.find("Retry-After: 1"), std::string::npos);
+    
+    auto with_budget = perform_raw_request("http://127.0.0.1:8097/work", {"X-Request-Timeout-Ms: 5000"});
+    EXPECT_EQ(with_budget.status, 200);
+    EXPECT_EQ(with_budget.body, "deadline");
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, AdmissionControlShedsBudgetsBelowExpectedQueueWait) {
+    HTTPServer::Builder builder;
+    auto server = builder.port(8106)
+                        .address("127.0.0.1")
+                        .worker_threads(1)
+                        .max_worker_threads(1)
+                        .admission_control(AdmissionOptions{})
+                        .get("/slow", [](const Request& req, Response& res) {
+                            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                            res.set_content("slow", "text/plain");
+                        })
+                        .get("/work", [](const Request& req, Response& res) {
+                            res.set_content("work", "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    // Five requests on a single worker queue behind each other, so the typical
+    // queue wait becomes several hundred milliseconds.
+    std::vector<std::future<RawResponse>> queued;
+    for (int i = 0; i < 5; ++i) {
+        queued.push_back(std::async(std::launch::async, [] {
+            return perform_raw_request("http://127.0.0.1:8106/slow");
+        }));
+    }
+    for (auto& response : queued) {
+        EXPECT_EQ(response.get().status, 200);
+    }
+    
+    auto hopeless = perform_raw_request("http://127.0.0.1:8106/work", {"X-Request-Timeout-Ms: 100"});
+    EXPECT_EQ(hopeless.status, 503);
+    EXPECT_EQ(hopeless.body, "Deadline exceeded");
+    EXPECT_NE(hopeless.headers.find("Retry-After: 1"), std::string::npos);
+    
+    auto with_budget = perform_raw_request("http://127.0.0.1:8106/work", {"X-Request-Timeout-Ms: 5000"});
+    EXPECT_EQ(with_budget.status, 200);
+    EXPECT_EQ(with_budget.body, "work");
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, RateLimitPerClientKey) {
+    RateLimitOptions limit;
+    limit.requests_per_second = 0.5;
+    limit.burst = 2;
+    limit.key_header = "X-Api-Key";
+    
+    HTTPServer::Builder builder;
+    auto server = builder.port(8098)
+                        .address("127.0.0.1")
+                        .rate_limit("/limited", limit)
+                        .get("/limited", [](const Request& req, Response& res) {
+                            res.set_content("ok", "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    EXPECT_EQ(perform_raw_request("http://127.0.0.1:8098/limited", {"X-Api-Key: alpha"}).status, 200);
+    EXPECT_EQ(perform_raw_request("http://127.0.0.1:8098/limited", {"X-Api-Key: alpha"}).status, 200);
+    
+    auto limited = perform_raw_request("http://127.0.0.1:8098/limited", {"X-Api-Key: alpha"});
+    EXPECT_EQ(limited.status, 429);
+    EXPECT_NE(limited.headers.find("Retry-After: 2"), std::string::npos);
+    
+    EXPECT_EQ(perform_raw_request("http://127.0.0.1:8098/limited", {"X-Api-Key: beta"}).status, 200);
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, TlsWithCertificateReload) {
+    TlsOptions tls;
+    tls.cert_path = "server_test_cert.pem";
+    tls.key_path = "server_test_key.pem";
+    tls.reload_interval = std::chrono::seconds(0);
+    write_self_signed_certificate(tls.cert_path, tls.key_path, "first.test");
+    
+    HTTPServer::Builder builder;
+    auto server = builder.port(8099)
+                        .address("127.0.0.1")
+                        .tls(tls)
+                        .get("/secure", [](const Request& req, Response& res) {
+                            res.set_content("secure", "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    auto response = perform_raw_request("https://127.0.0.1:8099/secure");
+    EXPECT_EQ(response.status, 200);
+    EXPECT_EQ(response.body, "secure");
+    EXPECT_NE(peer_certificate_subject("https://127.0.0.1:8099/secure").find("first.test"), std::string::npos);
+    
+    write_self_signed_certificate(tls.cert_path, tls.key_path, "second.test");
+    server->reload_certificates();
+    EXPECT_NE(peer_certificate_subject("https://127.0.0.1:8099/secure").find("second.test"), std::string::npos);
+    
+    std::remove(tls.key_path.c_str());
+    EXPECT_THROW(server->reload_certificates(), std::runtime_error);
+    EXPECT_EQ(perform_raw_request("https://127.0.0.1:8099/secure").status, 200);
+    
+    stop_server(server.get());
+    std::remove(tls.cert_path.c_str());
+}
+
+TEST_F(HTTPServerTest, ServerSentEventsBroadcast) {
+    auto broadcaster = std::make_shared<EventBroadcaster>();
+    
+    HTTPServer::Builder builder;
+    auto server = builder.port(8100)
+                        .address("127.0.0.1")
+                        .events("/events", broadcaster)
+                        .build();
+    
+    start_server(server.get());
+    
+    std::string events;
+    std::thread subscriber([&events] {
+        CURL* curl = curl_easy_init();
+        curl_easy_setopt(curl, CURLOPT_URL, "http://127.0.0.1:8100/events");
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CollectEvents);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &events);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 5000L);
+        curl_easy_perform(curl);
+        curl_easy_cleanup(curl);
+    });
+    
+    for (int attempt = 0; attempt < 200 && broadcaster->subscribers() == 0; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(broadcaster->subscribers(), 1u);
+    
+    broadcaster->publish("hello\nworld", "update", "1");
+    broadcaster->publish("one\r\ntwo\rthree", "update\r\ndata: injected", "2\n\nevent: injected");
+    broadcaster->publish("bye", "done");
+    subscriber.join();
+    
+    EXPECT_NE(events.find("id: 1\nevent: update\ndata: hello\ndata: world\n\n"), std::string::npos);
+    EXPECT_NE(events.find("id: 2event: injected\nevent: updatedata: injected\ndata: one\ndata: two\ndata: three\n\n"),
+              std::string::npos);
+    EXPECT_NE(events.find("event: done\ndata: bye\n\n"), std::string::npos);
+    
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, ServerSentEventsKeepWorkersForOtherRequests) {
+    auto broadcaster = std::make_shared<EventBroadcaster>();
+
+    HTTPServer::Builder builder;
+    auto server = builder.port(8104)
+                        .address("127.0.0.1")
+                        .worker_threads(1)
+                        .max_worker_threads(2)
+                        .events("/events", broadcaster)
+                        .get("/ping", [](const Request& req, Response& res) {
+                            res.set_content("pong", "text/plain");
+                        })
+                        .build();
+
+    start_server(server.get());
+
+    std::string events;
+    std::thread subscriber([&events] {
+        CURL* curl = curl_easy_init();
+        curl_easy_setopt(curl, CURLOPT_URL, "http://127.0.0.1:8104/events");
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CollectEvents);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &events);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 5000L);
+        curl_easy_perform(curl);
+        curl_easy_cleanup(curl);
+    });
+
+    for (int attempt = 0; attempt < 200 && broadcaster->subscribers() == 0; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(broadcaster->subscribers(), 1u);
+
+    auto refused = perform_raw_request("http://127.0.0.1:8104/events");
+    EXPECT_EQ(refused.status, 503);
+    EXPECT_NE(refused.headers.find("Retry-After: 1"), std::string::npos);
+    EXPECT_EQ(broadcaster->subscribers(), 1u);
+
+    auto ping = perform_raw_request("http://127.0.0.1:8104/ping");
+    EXPECT_EQ(ping.status, 200);
+    EXPECT_EQ(ping.body, "pong");
+
+    broadcaster->publish("bye", "done");
+    subscriber.join();
+    EXPECT_NE(events.find("event: done\ndata: bye\n\n"), std::string::npos);
+
+    stop_server(server.get());
+}
+
+TEST_F(HTTPServerTest, ResponseCacheStoresOnlyHandlerHeaders) {
+    std::atomic<int> requests{0};
+    CacheOptions cache_options;
+    cache_options.ttl = std::chrono::seconds(60);
+    
+    HTTPServer::Builder builder;
+    auto server = builder.port(8102)
+                        .address("127.0.0.1")
+                        .before([&requests](const Request& req, Response& res) {
+                            res.set_header("X-Request-Id", std::to_string(++requests));
+                            return true;
+                        })
+                        .cache("/profile", cache_options)
+                        .get("/profile", [](const Request& req, Response& res) {
+                            res.set_header("X-Rendered-By", "handler");
+                            res.set_content("profile", "text/plain");
+                        })
+                        .build();
+    
+    start_server(server.get());
+    
+    auto count = [](const std::string& headers, const std::string& name) {
+        size_t found = 0;
+        for (size_t pos = headers.find(name); pos != std::string::npos; pos = headers.find(name, pos + 1)) {
+            ++found;
+        }
+        return found;
+    };
+    
+    auto first = perform_raw_request("http://127.0.0.1:8102/profile");
+    auto second = perform_raw_request("http://127.0.0.1:8102/profile");
+    EXPECT_EQ(first.body, "profile");
+    EXPECT_EQ(second.body, "profile");
+    EXPECT_NE(first.headers.find("X-Request-Id: 1"), std::string::npos);
+    EXPECT_NE(second.headers.find("X-Request-Id: 2"), std::string::npos);
+    EXPECT_EQ(count(second.headers, "X-Request-Id:"), 1u);
+    EXPECT_EQ(count(second.headers, "X-Rendered-By: handler"), 1u);
+    
+    stop_server(server.get());
+}
+
 } // namespace cppwebforge
@@ -1,7 +1,12 @@
 #include <gtest/gtest.h>
 #include <thread>
 #include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <vector>
 #include "../include/performance.h"
+#include "../include/template_renderer.h"
 
 namespace cppwebforge {
 
@@ -23,4 +28,128 @@ TEST(PerformanceTest, ScopedPerformance) {
     std::this_thread::sleep_for(std::chrono::milliseconds(20));
 }
 
+TEST(PerformanceTest, TemplateContextReuse) {
+    constexpr int ROW_COUNT = 20000;
+    constexpr int RENDER_COUNT = 10;
+
+    std::filesystem::create_directories("perf_templates");
+    std::ofstream("perf_templates/listing.txt") << "{% for row in rows %}{{ row.id }}: {{ row.name }} {{ row.price }}\n{% endfor %}";
+
+    TemplateRenderer::DataArray rows;
+    rows.reserve(ROW_COUNT);
+    for (int i = 0; i < ROW_COUNT; ++i) {
+        TemplateRenderer::DataMap row;
+        row["id"] = i;
+        row["name"] = std::string("Product ") + std::to_string(i);
+        row["price"] = i * 1.25;
+        rows.push_back(std::move(row));
+    }
+    TemplateRenderer::DataMap data;
+    data["rows"] = std::move(rows);
+
+    TemplateRenderer renderer;
+    std::string fromDataMap;
+    std::string fromContext;
+    {
+        SCOPED_PERF("Render 20000 rows from DataMap x10");
+        for (int i = 0; i < RENDER_COUNT; ++i) {
+            fromDataMap = renderer.renderToString("perf_templates/listing.txt", data);
+        }
+    }
+    {
+        SCOPED_PERF("Render 20000 rows from prebuilt Context x10");
+        TemplateRenderer::Context context(data);
+        for (int i = 0; i < RENDER_COUNT; ++i) {
+            fromContext = renderer.renderToString("perf_templates/listing.txt", context);
+        }
+    }
+
+    EXPECT_EQ(fromDataMap, fromContext);
+    std::filesystem::remove_all("perf_templates");
+}
+
+TEST(PerformanceTest, TemplateDataDocumentBuild) {
+    constexpr int ROW_COUNT = 50000;
+
+    std::optional<TemplateRenderer::Context> fromDataMap;
+    {
+        SCOPED_PERF("Build 50000 rows as DataMap");
+        TemplateRenderer::DataArray rows;
+        rows.reserve(ROW_COUNT);
+        for (int i = 0; i < ROW_COUNT; ++i) {
+            TemplateRenderer::DataMap row;
+            row["id"] = i;
+            row["name"] = std::string("Product ") + std::to_string(i);
+            row["price"] = i * 1.25;
+            rows.push_back(std::move(row));
+        }
+        TemplateRenderer::DataMap data;
+        data["rows"] = std::move(rows);
+        fromDataMap.emplace(std::move(data));
+    }
+
+    std::optional<TemplateRenderer::Context> fromDocument;
+    {
+        SCOPED_PERF("Build 50000 rows as DataDocument");
+        TemplateRenderer::DataDocument document;
+        document.reserve(ROW_COUNT * 4 + 1, ROW_COUNT * 16);
+        document.beginArray("rows");
+        for (int i = 0; i < ROW_COUNT; ++i) {
+            document.beginObject()
+                .add("id", i)
+                .add("name", std::string("Product ") + std::to_string(i))
+                .add("price", i * 1.25)
+                .end();
+        }
+        document.end();
+        fromDocument.emplace(document);
+    }
+
+    std::filesystem::create_directories("perf_templates");
+    std::ofstream("perf_templates/count.txt") << "{{ length(rows) }} {{ rows.49999.name }}";
+    TemplateRenderer renderer;
+    EXPECT_EQ(renderer.renderToString("perf_templates/count.txt", *fromDataMap),
+              renderer.renderToString("perf_templates/count.txt", *fromDocument));
+    std::filesystem::remove_all("perf_templates");
+}
+
+TEST(PerformanceTest, TemplateBatchRendering) {
+    constexpr int PAGE_COUNT = 2000;
+
+    std::filesystem::create_directories("perf_templates");
+    std::ofstream("perf_templates/page.txt")
+        << "<h1>{{ title }}</h1>{% for item in items %}<li>{{ item }}</li>{% endfor %}";
+
+    std::vector<TemplateRenderer::RenderJob> jobs;
+    jobs.reserve(PAGE_COUNT);
+    for (int i = 0; i < PAGE_COUNT; ++i) {
+        TemplateRenderer::DataDocument document;
+        document.add("title", std::string("Page ") + std::to_string(i)).beginArray("items");
+        for (int item = 0; item < 50; ++item) {
+            document.add(item);
+        }
+        document.end();
+        jobs.push_back({"perf_templates/page.txt", std::to_string(i) + ".html", TemplateRenderer::Context(document)});
+    }
+
+    TemplateRenderer renderer;
+    {
+        SCOPED_PERF("Render 2000 pages one at a time");
+        for (const auto& job : jobs) {
+            renderer.renderTemplate(job.templatePath, "perf_output/sequential", job.outputFilename, job.context);
+        }
+    }
+
+    TemplateRenderer::BatchResult result;
+    {
+        SCOPED_PERF("Render 2000 pages as a batch");
+        result = renderer.renderBatch(jobs, "perf_output/batch");
+    }
+
+    EXPECT_EQ(result.rendered, static_cast<size_t>(PAGE_COUNT));
+    EXPECT_TRUE(result.failures.empty());
+    std::filesystem::remove_all("perf_templates");
+    std::filesystem::remove_all("perf_output");
+}
+
 } // namespace cppwebforge
@@ -1,22 +1,51 @@
 #include "../include/template_renderer.h"
 #include <gtest/gtest.h>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 namespace cppwebforge {
 
 class TemplateRendererTest : public ::testing::Test {
 protected:
+    // Compiled templates, registered sources and the revalidation interval are
+    // shared by the whole process, so every test starts and ends with them reset.
     void SetUp() override {
+        resetSharedTemplates();
         std::filesystem::create_directories("test_templates");
         std::filesystem::create_directories("test_output");
     }
 
     void TearDown() override {
+        for (const auto& name : registeredTemplates_) {
+            TemplateRenderer::unregisterTemplate(name);
+        }
+        resetSharedTemplates();
         std::filesystem::remove_all("test_templates");
         std::filesystem::remove_all("test_output");
     }
 
+    void resetSharedTemplates() {
+        TemplateRenderer::setRevalidationInterval(std::chrono::milliseconds(0));
+        renderer.reloadTemplates();
+    }
+
+    void registerTemplate(const std::string& name, const std::string& source) {
+        registeredTemplates_.push_back(name);
+        TemplateRenderer::registerTemplate(name, source);
+    }
+
+    void registerTemplates(const std::map<std::string, std::string>& templates) {
+        for (const auto& entry : templates) {
+            registeredTemplates_.push_back(entry.first);
+        }
+        TemplateRenderer::registerTemplates(templates);
+    }
+
     void createTemplateFile(const std::string& filename, const std::string& content) {
         std::ofstream file("test_templates/" + filename);
         file << content;
@@ -31,6 +60,9 @@ protected:
     }
 
     TemplateRenderer renderer;
+
+private:
+    std::vector<std::string> registeredTemplates_;
 };
 
 TEST_F(TemplateRendererTest, BasicTemplateRendering) {
@@ -213,4 +245,422 @@ TEST_F(TemplateRendererTest, NestedArrays) {
     EXPECT_EQ(readOutputFile("nested.txt"), expected);
 }
 
+TEST_F(TemplateRendererTest, RecompilesChangedTemplatesAndIncludes) {
+    createTemplateFile("header.txt", "Header v1");
+    createTemplateFile("page.txt", "{% include \"header.txt\" %} - {{ name }}");
+
+    TemplateRenderer::DataMap data;
+    data["name"] = std::string("World");
+
+    renderer.renderTemplate("test_templates/page.txt", "test_output", "page.txt", data);
+    EXPECT_EQ(readOutputFile("page.txt"), "Header v1 - World");
+
+    createTemplateFile("header.txt", "Header v2");
+    std::filesystem::last_write_time("test_templates/header.txt",
+                                     std::filesystem::file_time_type::clock::now() + std::chrono::seconds(1));
+
+    renderer.renderTemplate("test_templates/page.txt", "test_output", "page.txt", data);
+    EXPECT_EQ(readOutputFile("page.txt"), "Header v2 - World");
+}
+
+TEST_F(TemplateRendererTest, IncludesWithSameNameInDifferentDirectories) {
+    std::filesystem::create_directories("test_templates/partials");
+    createTemplateFile("header.txt", "site header");
+    createTemplateFile("partials/header.txt", "card header");
+    createTemplateFile("partials/card.txt", "<{% include \"header.txt\" %}>");
+    createTemplateFile("index.txt", "{% include \"header.txt\" %} {% include \"partials/card.txt\" %}");
+    createTemplateFile("reversed.txt", "{% include \"partials/card.txt\" %} {% include \"header.txt\" %}");
+
+    TemplateRenderer::DataMap data;
+    EXPECT_EQ(renderer.renderToString("test_templates/index.txt", data), "site header <card header>");
+    EXPECT_EQ(renderer.renderToString("test_templates/reversed.txt", data), "<card header> site header");
+    EXPECT_EQ(renderer.renderToString("test_templates/partials/card.txt", data), "<card header>");
+}
+
+TEST_F(TemplateRendererTest, RenderToStringStreamAndBuffer) {
+    createTemplateFile("inline.txt", "Hello {{ name }}!");
+    createTemplateFile("missing.txt", "Hello {{ missing }}!");
+
+    TemplateRenderer::DataMap data;
+    data["name"] = std::string("World");
+
+    EXPECT_EQ(renderer.renderToString("test_templates/inline.txt", data), "Hello World!");
+
+    std::ostringstream stream;
+    renderer.renderTo("test_templates/inline.txt", data, stream);
+    EXPECT_EQ(stream.str(), "Hello World!");
+
+    std::string buffer = "prefix:";
+    renderer.renderInto("test_templates/inline.txt", data, buffer);
+    EXPECT_EQ(buffer, "prefix:Hello World!");
+
+    EXPECT_THROW(renderer.renderInto("test_templates/missing.txt", data, buffer), TemplateError);
+    EXPECT_EQ(buffer, "prefix:Hello World!");
+    EXPECT_FALSE(std::filesystem::exists("test_output/inline.txt"));
+}
+
+TEST_F(TemplateRendererTest, ReusableContext) {
+    createTemplateFile("context.txt", "{{ title }}: {% for item in items %}{{ item }}{% endfor %}");
+
+    TemplateRenderer::DataArray items;
+    items.push_back(std::string("a"));
+    items.push_back(std::string("b"));
+
+    TemplateRenderer::DataMap data;
+    data["title"] = std::string("List");
+    data["items"] = items;
+
+    TemplateRenderer::Context context(data);
+    EXPECT_EQ(renderer.renderToString("test_templates/context.txt", context), "List: ab");
+
+    TemplateRenderer::Context renamed = context;
+    renamed.set("title", std::string("Renamed"));
+    EXPECT_EQ(renderer.renderToString("test_templates/context.txt", renamed), "Renamed: ab");
+    EXPECT_EQ(renderer.renderToString("test_templates/context.txt", context), "List: ab");
+}
+
+TEST_F(TemplateRendererTest, DataDocument) {
+    createTemplateFile("document.txt",
+        "{{ title }} ({{ count }}):{% for row in rows %} {{ row.name }}={{ row.price }}{% if row.stock %}*{% endif %}{% endfor %}");
+
+    TemplateRenderer::DataDocument document;
+    document.add("title", "Products").add("count", 2).beginArray("rows");
+    document.beginObject().add("name", "Pen").add("price", 1.5).add("stock", true).end();
+    document.beginObject().add("name", "A considerably longer name").add("price", 20).add("stock", false).end();
+    document.end();
+
+    TemplateRenderer::Context context(document);
+    EXPECT_EQ(renderer.renderToString("test_templates/document.txt", context),
+              "Products (2): Pen=1.5* A considerably longer name=20");
+
+    TemplateRenderer::DataDocument copy = document;
+    copy.add("extra", 1);
+    EXPECT_EQ(document.size(), copy.size() - 1);
+
+    createTemplateFile("counts.txt", "{{ items }} {{ bytes }} {{ total }} {{ delta }}:{% for n in sizes %} {{ n }}{% endfor %}");
+    std::vector<std::string> items = {"a", "b", "c"};
+    TemplateRenderer::DataDocument counts;
+    counts.add("items", items.size())
+        .add("bytes", 4096u)
+        .add("total", UINT64_MAX)
+        .add("delta", -7LL)
+        .beginArray("sizes")
+        .add(uint16_t{8})
+        .add(size_t{16})
+        .end();
+    EXPECT_EQ(renderer.renderToString("test_templates/counts.txt", TemplateRenderer::Context(counts)),
+              "3 4096 18446744073709551615 -7: 8 16");
+
+    TemplateRenderer::DataDocument invalid;
+    invalid.beginArray("rows");
+    EXPECT_THROW(invalid.add("key", 1), TemplateError);
+    EXPECT_THROW(TemplateRenderer::Context{invalid}, TemplateError);
+    invalid.end();
+    EXPECT_THROW(invalid.end(), TemplateError);
+}
+
+TEST_F(TemplateRendererTest, SharedRendererAcrossThreads) {
+    createTemplateFile("item.txt", "{% include \"header.txt\" %}{% for i in items %}{{ i }},{% endfor %}{{ id }}");
+    createTemplateFile("header.txt", "items:");
+
+    const TemplateRenderer& shared = renderer;
+    constexpr int THREAD_COUNT = 8;
+    constexpr int RENDERS_PER_THREAD = 200;
+    std::vector<int> failures(THREAD_COUNT, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREAD_COUNT; ++t) {
+        threads.emplace_back([&shared, &failures, t] {
+            for (int i = 0; i < RENDERS_PER_THREAD; ++i) {
+                TemplateRenderer::DataMap data;
+                data["items"] = TemplateRenderer::DataArray{1, 2, 3};
+                data["id"] = t * RENDERS_PER_THREAD + i;
+                std::string expected = "items:1,2,3," + std::to_string(t * RENDERS_PER_THREAD + i);
+                if (shared.renderToString("test_templates/item.txt", data) != expected) {
+                    ++failures[t];
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (int t = 0; t < THREAD_COUNT; ++t) {
+        EXPECT_EQ(failures[t], 0) << "thread " << t;
+    }
+}
+
+TEST_F(TemplateRendererTest, RevalidationInterval) {
+    createTemplateFile("interval.txt", "v1");
+    TemplateRenderer::DataMap data;
+
+    TemplateRenderer::setRevalidationInterval(std::chrono::hours(1));
+    EXPECT_EQ(renderer.renderToString("test_templates/interval.txt", data), "v1");
+
+    createTemplateFile("interval.txt", "v2");
+    std::filesystem::last_write_time("test_templates/interval.txt",
+                                     std::filesystem::file_time_type::clock::now() + std::chrono::seconds(1));
+    EXPECT_EQ(renderer.renderToString("test_templates/interval.txt", data), "v1");
+
+    renderer.reloadTemplate("test_templates/interval.txt");
+    EXPECT_EQ(renderer.renderToString("test_templates/interval.txt", data), "v2");
+}
+
+TEST_F(TemplateRendererTest, RenderBatch) {
+    createTemplateFile("page.txt", "Page {{ id }}");
+    createTemplateFile("broken.txt", "{{ missing }}");
+
+    std::vector<TemplateRenderer::RenderJob> jobs;
+    for (int i = 0; i < 40; ++i) {
+        TemplateRenderer::DataMap data;
+        data["id"] = i;
+        std::string filename = (i % 2 == 0 ? "even/" : "odd/") + std::to_string(i) + ".txt";
+        jobs.push_back({"test_templates/page.txt", filename, TemplateRenderer::Context(data)});
+    }
+    jobs.push_back({"test_templates/broken.txt", "broken.txt", TemplateRenderer::Context()});
+    jobs.push_back({"test_templates/absent.txt", "absent.txt", TemplateRenderer::Context()});
+
+    auto result = renderer.renderBatch(jobs, "test_output", 4);
+
+    EXPECT_EQ(result.rendered, 40u);
+    ASSERT_EQ(result.failures.size(), 2u);
+    EXPECT_EQ(result.failures[0].job, 40u);
+    EXPECT_EQ(result.failures[1].job, 41u);
+    EXPECT_NE(result.failures[1].message.find("does not exist"), std::string::npos);
+
+    EXPECT_EQ(readOutputFile("even/0.txt"), "Page 0");
+    EXPECT_EQ(readOutputFile("odd/39.txt"), "Page 39");
+    EXPECT_FALSE(std::filesystem::exists("test_output/absent.txt"));
+}
+
+TEST_F(TemplateRendererTest, IncrementalBuildsWithManifest) {
+    createTemplateFile("post.txt", "Post {{ id }}");
+
+    auto makeJobs = [](int changedId) {
+        std::vector<TemplateRenderer::RenderJob> jobs;
+        for (int i = 0; i < 3; ++i) {
+            TemplateRenderer::DataMap data;
+            data["id"] = i == changedId ? 100 + i : i;
+            jobs.push_back({"test_templates/post.txt", std::to_string(i) + ".txt", TemplateRenderer::Context(data)});
+        }
+        return jobs;
+    };
+
+    {
+        TemplateRenderer builder;
+        builder.useManifest("test_output/manifest");
+        auto first = builder.renderBatch(makeJobs(-1), "test_output");
+        EXPECT_EQ(first.rendered, 3u);
+        EXPECT_EQ(first.skipped, 0u);
+
+        auto second = builder.renderBatch(makeJobs(1), "test_output");
+        EXPECT_EQ(second.rendered, 1u);
+        EXPECT_EQ(second.skipped, 2u);
+        EXPECT_EQ(readOutputFile("1.txt"), "Post 101");
+    }
+
+    TemplateRenderer restarted;
+    restarted.useManifest("test_output/manifest");
+    auto unchanged = restarted.renderBatch(makeJobs(1), "test_output");
+    EXPECT_EQ(unchanged.rendered, 0u);
+    EXPECT_EQ(unchanged.skipped, 3u);
+
+    // Touching the template forces a render, but identical bytes are not rewritten.
+    auto past = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+    std::filesystem::last_write_time("test_output/0.txt", past);
+    std::filesystem::last_write_time("test_templates/post.txt",
+                                     std::filesystem::file_time_type::clock::now() + std::chrono::seconds(1));
+    auto touched = restarted.renderBatch(makeJobs(1), "test_output");
+    EXPECT_EQ(touched.rendered, 3u);
+    EXPECT_EQ(std::filesystem::last_write_time("test_output/0.txt"), past);
+
+    std::filesystem::remove("test_output/2.txt");
+    auto removed = restarted.renderBatch(makeJobs(1), "test_output");
+    EXPECT_EQ(removed.rendered, 1u);
+    EXPECT_EQ(readOutputFile("2.txt"), "Post 2");
+}
+
+TEST_F(TemplateRendererTest, AtomicOutputWithGzipSibling) {
+    createTemplateFile("gzip.txt", "{% for i in items %}line {{ i }}\n{% endfor %}");
+
+    TemplateRenderer::DataArray items;
+    for (int i = 0; i < 100; ++i) {
+        items.push_back(i);
+    }
+    TemplateRenderer::DataMap data;
+    data["items"] = items;
+
+    TemplateRenderer::OutputOptions options;
+    options.gzip = true;
+    options.sync = TemplateRenderer::SyncPolicy::FileAndDirectory;
+    TemplateRenderer writer;
+    writer.setOutputOptions(options);
+    writer.renderTemplate("test_templates/gzip.txt", "test_output", "gzip.txt", data);
+
+    std::string expected = writer.renderToString("test_templates/gzip.txt", data);
+    EXPECT_EQ(readOutputFile("gzip.txt"), expected);
+    ASSERT_TRUE(std::filesystem::exists("test_output/gzip.txt.gz"));
+    EXPECT_LT(std::filesystem::file_size("test_output/gzip.txt.gz"), expected.size());
+
+    std::ifstream compressed("test_output/gzip.txt.gz", std::ios::binary);
+    unsigned char magic[2] = {};
+    compressed.read(reinterpret_cast<char*>(magic), 2);
+    EXPECT_EQ(magic[0], 0x1f);
+    EXPECT_EQ(magic[1], 0x8b);
+
+    for (const auto& entry : std::filesystem::directory_iterator("test_output")) {
+        EXPECT_EQ(entry.path().filename().string().find(".tmp."), std::string::npos);
+    }
+}
+
+TEST_F(TemplateRendererTest, InMemoryTemplates) {
+    registerTemplate("memory/part.txt", "Hello {{ name }}");
+    registerTemplate("memory/page.txt", "[{% include \"part.txt\" %}]");
+
+    TemplateRenderer::DataMap data;
+    data["name"] = std::string("World");
+    EXPECT_EQ(renderer.renderToString("memory/page.txt", data), "[Hello World]");
+
+    createTemplateFile("disk.txt", "{% include \"memory.txt\" %} from disk");
+    registerTemplate("test_templates/memory.txt", "{{ name }}");
+    EXPECT_EQ(renderer.renderToString("test_templates/disk.txt", data), "World from disk");
+
+    registerTemplate("memory/part.txt", "Goodbye {{ name }}");
+    EXPECT_EQ(renderer.renderToString("memory/page.txt", data), "[Goodbye World]");
+
+    EXPECT_THROW(registerTemplate("memory/part.txt", "{% if %}"), TemplateError);
+    EXPECT_EQ(renderer.renderToString("memory/page.txt", data), "[Goodbye World]");
+
+    EXPECT_THROW(registerTemplate("memory/broken.txt", "{% if %}"), TemplateError);
+    EXPECT_THROW(renderer.renderToString("memory/broken.txt", data), TemplateError);
+}
+
+TEST_F(TemplateRendererTest, PreloadDirectory) {
+    std::filesystem::create_directories("test_templates/partials");
+    createTemplateFile("partials/footer.txt", "footer");
+    createTemplateFile("home.txt", "home {% include \"partials/footer.txt\" %}");
+    createTemplateFile("about.txt", "about {% include \"partials/footer.txt\" %}");
+
+    createTemplateFile("broken.tpl", "{% if %}");
+
+    EXPECT_EQ(TemplateRenderer::preloadDirectory("test_templates", {".txt"}), 3u);
+    try {
+        TemplateRenderer::preloadDirectory("test_templates");
+        FAIL() << "expected the broken template to be reported";
+    } catch (const TemplateError& e) {
+        EXPECT_NE(std::string(e.what()).find("broken.tpl"), std::string::npos);
+        EXPECT_EQ(std::string(e.what()).find("home.txt"), std::string::npos);
+    }
+
+    TemplateRenderer::DataMap data;
+    EXPECT_EQ(renderer.renderToString("test_templates/home.txt", data), "home footer");
+    EXPECT_EQ(renderer.renderToString("test_templates/about.txt", data), "about footer");
+    EXPECT_THROW(TemplateRenderer::preloadDirectory("test_templates/absent"), TemplateError);
+}
+
+TEST_F(TemplateRendererTest, RenderStream) {
+    createTemplateFile("export.csv", "{% for row in rows %}{{ row }},value-{{ row }}\n{% endfor %}");
+
+    TemplateRenderer::DataArray rows;
+    for (int i = 0; i < 1000; ++i) {
+        rows.push_back(i);
+    }
+    TemplateRenderer::DataMap data;
+    data["rows"] = rows;
+    std::string expected = renderer.renderToString("test_templates/export.csv", data);
+
+    std::string streamed;
+    size_t chunks = 0;
+    bool largestWithinBuffer = true;
+    EXPECT_TRUE(renderer.renderStream("test_templates/export.csv", data, [&](std::string_view chunk) {
+        largestWithinBuffer = largestWithinBuffer && chunk.size() <= 256;
+        streamed.append(chunk);
+        ++chunks;
+        return true;
+    }, 256));
+    EXPECT_EQ(streamed, expected);
+    EXPECT_GT(chunks, expected.size() / 256);
+    EXPECT_TRUE(largestWithinBuffer);
+
+    size_t stoppedAfter = 0;
+    EXPECT_FALSE(renderer.renderStream("test_templates/export.csv", data, [&](std::string_view) {
+        return ++stoppedAfter < 3;
+    }, 256));
+    EXPECT_EQ(stoppedAfter, 3u);
+}
+
+TEST_F(TemplateRendererTest, InMemoryTemplateShadowsCompiledFile) {
+    createTemplateFile("shadowed.txt", "disk");
+    createTemplateFile("outer.txt", "[{% include \"shadowed.txt\" %}]");
+
+    TemplateRenderer::DataMap data;
+    EXPECT_EQ(renderer.renderToString("test_templates/shadowed.txt", data), "disk");
+    EXPECT_EQ(renderer.renderToString("test_templates/outer.txt", data), "[disk]");
+
+    registerTemplate("test_templates/shadowed.txt", "memory");
+    EXPECT_EQ(renderer.renderToString("test_templates/shadowed.txt", data), "memory");
+    EXPECT_EQ(renderer.renderToString("test_templates/outer.txt", data), "[memory]");
+}
+
+TEST_F(TemplateRendererTest, InMemoryTemplateRegistration) {
+    TemplateRenderer::DataMap data;
+    registerTemplates({{"bundle/page.txt", "[{% include \"part.txt\" %}]"},
+                                         {"bundle/part.txt", "part"}});
+    EXPECT_EQ(renderer.renderToString("bundle/page.txt", data), "[part]");
+
+    EXPECT_THROW(registerTemplates({{"bundle/part.txt", "new part"}, {"bundle/zz.txt", "{% if %}"}}),
+                 TemplateError);
+    EXPECT_EQ(renderer.renderToString("bundle/page.txt", data), "[part]");
+    EXPECT_THROW(renderer.renderToString("bundle/zz.txt", data), TemplateError);
+
+    createTemplateFile("cached.txt", "v1");
+    TemplateRenderer::setRevalidationInterval(std::chrono::hours(1));
+    EXPECT_EQ(renderer.renderToString("test_templates/cached.txt", data), "v1");
+    createTemplateFile("cached.txt", "v2");
+    std::filesystem::last_write_time("test_templates/cached.txt",
+                                     std::filesystem::file_time_type::clock::now() + std::chrono::seconds(1));
+    registerTemplate("bundle/part.txt", "other part");
+    EXPECT_EQ(renderer.renderToString("test_templates/cached.txt", data), "v1");
+    EXPECT_EQ(renderer.renderToString("bundle/page.txt", data), "[other part]");
+
+    createTemplateFile("removable.txt", "disk");
+    createTemplateFile("wrapper.txt", "<{% include \"removable.txt\" %}>");
+    registerTemplate("test_templates/removable.txt", "memory");
+    EXPECT_EQ(renderer.renderToString("test_templates/wrapper.txt", data), "<memory>");
+    TemplateRenderer::unregisterTemplate("test_templates/removable.txt");
+    EXPECT_EQ(renderer.renderToString("test_templates/wrapper.txt", data), "<disk>");
+    TemplateRenderer::unregisterTemplate("bundle/page.txt");
+    EXPECT_THROW(renderer.renderToString("bundle/page.txt", data), TemplateError);
+}
+
+TEST_F(TemplateRendererTest, ManifestBuildAddsMissingGzipSiblings) {
+    createTemplateFile("sibling.txt", "{% for i in items %}entry {{ i }}\n{% endfor %}");
+
+    TemplateRenderer::DataArray items;
+    for (int i = 0; i < 50; ++i) {
+        items.push_back(i);
+    }
+    TemplateRenderer::DataMap data;
+    data["items"] = items;
+    std::vector<TemplateRenderer::RenderJob> jobs = {
+        {"test_templates/sibling.txt", "a.txt", TemplateRenderer::Context(data)},
+        {"test_templates/sibling.txt", "b.txt", TemplateRenderer::Context(data)},
+    };
+
+    TemplateRenderer builder;
+    builder.useManifest("test_output/manifest");
+    EXPECT_EQ(builder.renderBatch(jobs, "test_output").rendered, 2u);
+    EXPECT_FALSE(std::filesystem::exists("test_output/a.txt.gz"));
+
+    TemplateRenderer::OutputOptions options;
+    options.gzip = true;
+    builder.setOutputOptions(options);
+    auto rebuilt = builder.renderBatch(jobs, "test_output");
+    EXPECT_EQ(rebuilt.skipped, 0u);
+    EXPECT_TRUE(std::filesystem::exists("test_output/a.txt.gz"));
+    EXPECT_TRUE(std::filesystem::exists("test_output/b.txt.gz"));
+
+    EXPECT_EQ(builder.renderBatch(jobs, "test_output").skipped, 2u);
+}
+
 } // namespace cppwebforge